@@ -0,0 +1,8 @@
+;;; Ackermann function, deep and irregular recursion
+
+(define (ack m n)
+  (cond ((= m 0) (+ n 1))
+        ((= n 0) (ack (- m 1) 1))
+        (else (ack (- m 1) (ack m (- n 1))))))
+
+(define (run) (ack 3 4))
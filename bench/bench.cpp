@@ -0,0 +1,211 @@
+/* Benchmark harness:
+ * every benchmark is a file bench/<name>.scm which defines (run), the
+ * harness loads it, calls (run) once to warm up, then times repeated calls.
+ *
+ * Usage: bench [--dir path] [--repeat n] [--save file] [--baseline file]
+ *              [--threshold percent] [name ...]
+ * Results are printed as JSON lines, such as:
+ * {"name": "fib", "time_ms": 12.500, "calls": 100, "cons": 20, ...}
+ * --save writes the results to file, --baseline compares the results with
+ * a saved file, and returns 1 if a benchmark is slower than the threshold.
+ */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "../eval.h"
+#include "../io_function.h"
+#include "../scheme.h"
+
+#ifndef BENCH_DIR
+#define BENCH_DIR "bench"
+#endif
+
+/* Default benchmarks, in the order of running */
+static const vector<string> benchmarks{
+	"fib", "tak", "ackermann", "queens", "string_build", "sort",
+	"closure", "deep_recursion", "loop", "text"
+};
+
+/* Result of a benchmark */
+struct Result {
+	string	name;
+	double	time_ms;	/* Median time of (run) */
+	size_t	calls;		/* Procedure calls of a (run) */
+	size_t	cons;		/* Pairs allocated by a (run) */
+	size_t	frames;		/* Environment frames created by a (run) */
+	long	peak_rss_kb;	/* Peak memory of the process so far */
+};
+
+/* Return the peak resident set size of the process in KB */
+static long peak_rss_kb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return static_cast<long>(counters.PeakWorkingSetSize / 1024);
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;		/* KB on Linux */
+#endif
+}
+
+/* Load dir/name.scm and time (run) */
+static Result run_benchmark(const string& dir, const string& name, int repeat)
+{
+	Interpreter interp;
+	/* Output of benchmarks and "Loading ..." are discarded */
+	interp.output_port = make_shared<OutputPort>(
+		unique_ptr<ostream>(new ostringstream()));
+	load_file(interp, dir + "/" + name + ".scm");
+	Object run = interp.lookup("run");
+	interp.call(run, {});	/* Warm up */
+
+	interp.stats = make_shared<RuntimeStats>();
+	vector<double> times;
+	for (int i = 0; i < repeat; i++) {
+		auto start = chrono::steady_clock::now();
+		interp.call(run, {});
+		auto end = chrono::steady_clock::now();
+		times.push_back(chrono::duration<double, milli>(end - start).count());
+	}
+	sort(times.begin(), times.end());
+
+	Result result;
+	result.name = name;
+	result.time_ms = times[times.size() / 2];
+	result.calls = interp.stats->get_calls() / repeat;
+	result.cons = interp.stats->get_cons() / repeat;
+	result.frames = interp.stats->get_frames() / repeat;
+	result.peak_rss_kb = peak_rss_kb();
+	return result;
+}
+
+static string to_json(const Result& r)
+{
+	char line[512];
+	snprintf(line, sizeof(line), "{\"name\": \"%s\", \"time_ms\": %.3f, "
+		"\"calls\": %zu, \"cons\": %zu, \"frames\": %zu, "
+		"\"peak_rss_kb\": %ld}", r.name.c_str(), r.time_ms, r.calls,
+		r.cons, r.frames, r.peak_rss_kb);
+	return line;
+}
+
+/* Read results saved by --save */
+static map<string, Result> read_results(const string& filename)
+{
+	map<string, Result> results;
+	ifstream file(filename);
+	if (!file) {
+		cerr << "ERROR(bench): couldn't open file -- " << filename << endl;
+		exit(2);
+	}
+	string line;
+	while (getline(file, line)) {
+		Result r;
+		char name[128];
+		if (sscanf(line.c_str(), "{\"name\": \"%127[^\"]\", \"time_ms\": %lf, "
+			"\"calls\": %zu, \"cons\": %zu, \"frames\": %zu, "
+			"\"peak_rss_kb\": %ld}", name, &r.time_ms, &r.calls, &r.cons,
+			&r.frames, &r.peak_rss_kb) != 6)
+			continue;
+		r.name = name;
+		results[r.name] = r;
+	}
+	return results;
+}
+
+/* Compare results with baseline, return false if there is a regression */
+static bool compare(const vector<Result>& results,
+	const map<string, Result>& baseline, double threshold)
+{
+	bool ok = true;
+	for (auto &r : results) {
+		auto found = baseline.find(r.name);
+		if (found == baseline.end()) {
+			fprintf(stderr, "%-16s no baseline\n", r.name.c_str());
+			continue;
+		}
+		const Result& base = found->second;
+		double change = (r.time_ms / base.time_ms - 1.0) * 100.0;
+		bool slow = change > threshold;
+		fprintf(stderr, "%-16s %10.3f ms  baseline %10.3f ms  %+7.1f%%%s\n",
+			r.name.c_str(), r.time_ms, base.time_ms, change,
+			slow ? "  REGRESSION" : "");
+		if (r.calls != base.calls || r.cons != base.cons)
+			fprintf(stderr, "%-16s calls %zu (baseline %zu), cons %zu "
+				"(baseline %zu)\n", "", r.calls, base.calls, r.cons, base.cons);
+		if (slow)
+			ok = false;
+	}
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	string dir = BENCH_DIR, save, baseline;
+	int repeat = 5;
+	double threshold = 10.0;
+	vector<string> names;
+	for (int i = 1; i < argc; i++) {
+		string arg = argv[i];
+		if (arg == "--dir" && i + 1 < argc)
+			dir = argv[++i];
+		else if (arg == "--repeat" && i + 1 < argc)
+			repeat = std::max(1, atoi(argv[++i]));
+		else if (arg == "--save" && i + 1 < argc)
+			save = argv[++i];
+		else if (arg == "--baseline" && i + 1 < argc)
+			baseline = argv[++i];
+		else if (arg == "--threshold" && i + 1 < argc)
+			threshold = atof(argv[++i]);
+		else if (arg.compare(0, 2, "--") == 0) {
+			cerr << "Usage: bench [--dir path] [--repeat n] [--save file] "
+				"[--baseline file] [--threshold percent] [name ...]" << endl;
+			return 2;
+		}
+		else
+			names.push_back(arg);
+	}
+	if (names.empty())
+		names = benchmarks;
+
+	vector<Result> results;
+	try {
+		for (auto &name : names) {
+			results.push_back(run_benchmark(dir, name, repeat));
+			cout << to_json(results.back()) << endl;
+		}
+	}
+	catch (const SchemeError& e) {
+		cerr << e.what() << endl;
+		return 2;
+	}
+
+	if (!save.empty()) {
+		ofstream file(save);
+		for (auto &r : results)
+			file << to_json(r) << '\n';
+	}
+	if (!baseline.empty() && !compare(results, read_results(baseline), threshold))
+		return 1;
+	return 0;
+}
@@ -0,0 +1,24 @@
+;;; Closures with local state, updated by set!
+
+(define (make-counter)
+  (let ((count 0))
+    (lambda ()
+      (set! count (+ count 1))
+      count)))
+
+(define (make-counters n)
+  (if (= n 0)
+      '()
+      (cons (make-counter) (make-counters (- n 1)))))
+
+(define (tick-all counters)
+  (if (null? counters)
+      0
+      (+ ((car counters)) (tick-all (cdr counters)))))
+
+(define (repeat counters k)
+  (if (= k 1)
+      (tick-all counters)
+      (begin (tick-all counters) (repeat counters (- k 1)))))
+
+(define (run) (repeat (make-counters 20) 200))
@@ -0,0 +1,8 @@
+;;; Deep non-tail recursion, the depth of environments
+
+(define (count-down n)
+  (if (= n 0)
+      0
+      (+ 1 (count-down (- n 1)))))
+
+(define (run) (count-down 1000))
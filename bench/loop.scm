@@ -0,0 +1,14 @@
+;;; Loops of do and named let, iterations update one frame in place
+
+(define (sum-do n)
+  (do ((i 0 (+ i 1))
+       (sum 0 (+ sum (remainder i 7))))
+      ((= i n) sum)))
+
+(define (count-evens n)
+  (let loop ((i 0) (count 0))
+    (cond ((= i n) count)
+          ((even? i) (loop (+ i 1) (+ count 1)))
+          (else (loop (+ i 1) count)))))
+
+(define (run) (+ (sum-do 20000) (count-evens 20000)))
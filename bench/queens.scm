@@ -0,0 +1,60 @@
+;;; SICP exercise 2.42, n-queens by filtering lists, see test_file/test4
+
+(define (accumulate op initial sequence)
+  (if (null? sequence)
+      initial
+      (op (car sequence)
+          (accumulate op initial (cdr sequence)))))
+
+(define (filter predicate sequence)
+  (cond ((null? sequence) '())
+        ((predicate (car sequence))
+         (cons (car sequence)
+               (filter predicate (cdr sequence))))
+        (else (filter predicate (cdr sequence)))))
+
+(define (enumerate-interval low high)
+  (if (> low high)
+      '()
+      (cons low (enumerate-interval (+ low 1) high))))
+
+(define (flatmap proc seq)
+  (accumulate append '() (map proc seq)))
+
+(define (adjoin-position new-row k rest-of-queens)
+  (cons new-row rest-of-queens))
+
+(define (safe? k position)
+  (iter (car position)
+        (cdr position)
+        1))
+
+(define (iter row-of-new-queen rest-of-queens i)
+  (if (null? rest-of-queens)
+      #t
+      (let ((row-of-current-queen (car rest-of-queens)))
+        (if (or (= row-of-new-queen row-of-current-queen)
+                (= row-of-new-queen (+ row-of-current-queen i))
+                (= row-of-new-queen (- row-of-current-queen i)))
+            #f
+            (iter row-of-new-queen
+                  (cdr rest-of-queens)
+                  (+ 1 i))))))
+
+(define empty-board '())
+
+(define (queens board-size)
+  (define (queen-cols k)
+    (if (= k 0)
+        (list empty-board)
+        (filter
+         (lambda (positions) (safe? k positions))
+         (flatmap
+          (lambda (rest-of-queens)
+            (map (lambda (new-row)
+                   (adjoin-position new-row k rest-of-queens))
+                 (enumerate-interval 1 board-size)))
+          (queen-cols (- k 1))))))
+  (queen-cols board-size))
+
+(define (run) (length (queens 6)))
@@ -0,0 +1,34 @@
+;;; Merge sort of a list, list construction and comparison
+
+(define (short? lst)
+  (if (null? lst) #t (null? (cdr lst))))
+
+(define (split lst)
+  (if (short? lst)
+      (cons lst '())
+      (let ((rest (split (cddr lst))))
+        (cons (cons (car lst) (car rest))
+              (cons (cadr lst) (cdr rest))))))
+
+(define (merge a b)
+  (cond ((null? a) b)
+        ((null? b) a)
+        ((< (car a) (car b)) (cons (car a) (merge (cdr a) b)))
+        (else (cons (car b) (merge a (cdr b))))))
+
+(define (merge-sort lst)
+  (if (short? lst)
+      lst
+      (let ((halves (split lst)))
+        (merge (merge-sort (car halves)) (merge-sort (cdr halves))))))
+
+;; Pseudo random numbers, a linear congruential generator
+(define (random-list seed n)
+  (if (= n 0)
+      '()
+      (cons seed (random-list (remainder (+ (* seed 1103) 12345) 32768)
+                              (- n 1)))))
+
+(define data (random-list 42 200))
+
+(define (run) (car (merge-sort data)))
@@ -0,0 +1,12 @@
+;;; Building a string piece by piece in a string port
+
+(define (build out i n)
+  (if (< i n)
+      (begin
+        (write-string "item " out)
+        (write i out)
+        (write-char #\, out)
+        (build out (+ i 1) n))
+      (get-output-string out)))
+
+(define (run) (build (open-output-string) 0 1000))
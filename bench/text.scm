@@ -0,0 +1,19 @@
+;;; Text processing: split lines into fields, parse and format numbers
+
+(define line "alpha,12,beta,7,gamma,30,delta,5")
+
+(define (sum-fields fields acc)
+  (if (null? fields)
+      acc
+      (sum-fields (cddr fields) (+ acc (string->number (cadr fields))))))
+
+(define (format-line i)
+  (string-append "row " (number->string i) ": "
+                 (number->string (sum-fields (string-split line #\,) 0))))
+
+(define (process i n total)
+  (if (< i n)
+      (process (+ i 1) n (+ total (string-length (format-line i))))
+      total))
+
+(define (run) (process 0 500 0))
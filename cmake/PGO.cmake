@@ -0,0 +1,82 @@
+# Profile guided optimization workflow, run by the target "pgo":
+#   cmake --build build --target pgo
+# or directly:
+#   cmake -DSOURCE_DIR=. -DBINARY_DIR=build/pgo-workflow -P cmake/PGO.cmake
+#
+# 1. build Release and save the results of the benchmarks as release.json;
+# 2. build an instrumented binary, train it with the unit tests(test_file)
+#    and the benchmarks(bench);
+# 3. rebuild the same tree with the profile;
+# 4. compare the benchmarks of the optimized build with release.json, the
+#    report is written to report.txt.
+
+cmake_minimum_required(VERSION 3.13)
+
+if(NOT SOURCE_DIR OR NOT BINARY_DIR)
+	message(FATAL_ERROR "usage: cmake -DSOURCE_DIR=<source> "
+		"-DBINARY_DIR=<dir> -P PGO.cmake")
+endif()
+get_filename_component(SOURCE_DIR "${SOURCE_DIR}" ABSOLUTE)
+get_filename_component(BINARY_DIR "${BINARY_DIR}" ABSOLUTE)
+if(NOT CXX_COMPILER)
+	set(CXX_COMPILER "c++")
+endif()
+
+set(RELEASE_DIR "${BINARY_DIR}/release")
+set(PGO_DIR "${BINARY_DIR}/pgo")
+set(PROFILE_DIR "${BINARY_DIR}/profile")
+
+# Run a command, stop if it fails
+function(run_step)
+	execute_process(COMMAND ${ARGN} RESULT_VARIABLE result)
+	if(NOT result EQUAL 0)
+		message(FATAL_ERROR "PGO: failed: ${ARGN}")
+	endif()
+endfunction()
+
+function(configure_build dir)
+	run_step(${CMAKE_COMMAND} -S "${SOURCE_DIR}" -B "${dir}"
+		-DCMAKE_BUILD_TYPE=Release -DCMAKE_CXX_COMPILER=${CXX_COMPILER}
+		-DSCHEME_PGO_DIR=${PROFILE_DIR} ${ARGN})
+	run_step(${CMAKE_COMMAND} --build "${dir}")
+endfunction()
+
+message(STATUS "PGO: building Release")
+configure_build("${RELEASE_DIR}" -DSCHEME_PGO=)
+run_step("${RELEASE_DIR}/scheme_bench" --save "${BINARY_DIR}/release.json")
+
+message(STATUS "PGO: building the instrumented binaries")
+file(REMOVE_RECURSE "${PROFILE_DIR}")
+file(MAKE_DIRECTORY "${PROFILE_DIR}")
+configure_build("${PGO_DIR}" -DSCHEME_PGO=GENERATE)
+
+message(STATUS "PGO: training")
+set(ENV{LLVM_PROFILE_FILE} "${PROFILE_DIR}/scheme-%p.profraw")
+execute_process(COMMAND "${PGO_DIR}/scheme_tests"
+	WORKING_DIRECTORY "${SOURCE_DIR}" OUTPUT_QUIET ERROR_QUIET)
+run_step("${PGO_DIR}/scheme_bench" --repeat 3)
+
+# Clang reads a merged profile
+file(GLOB raw_profiles "${PROFILE_DIR}/*.profraw")
+if(raw_profiles)
+	find_program(LLVM_PROFDATA NAMES llvm-profdata)
+	if(NOT LLVM_PROFDATA)
+		message(FATAL_ERROR "PGO: llvm-profdata is required by Clang")
+	endif()
+	run_step("${LLVM_PROFDATA}" merge -output=${PROFILE_DIR}/scheme.profdata
+		${raw_profiles})
+endif()
+
+message(STATUS "PGO: building with the profile")
+configure_build("${PGO_DIR}" -DSCHEME_PGO=USE)
+
+message(STATUS "PGO: comparing with Release")
+execute_process(COMMAND "${PGO_DIR}/scheme_bench"
+	--baseline "${BINARY_DIR}/release.json" --threshold 1000
+	OUTPUT_VARIABLE results ERROR_VARIABLE report)
+file(WRITE "${BINARY_DIR}/report.txt"
+	"Time of PGO build, compared with Release (negative is faster):\n"
+	"${report}\nResults of PGO build:\n${results}")
+message("${report}")
+message(STATUS "PGO: optimized binaries are in ${PGO_DIR}, "
+	"report is ${BINARY_DIR}/report.txt")
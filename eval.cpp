@@ -4,27 +4,123 @@
 
 //#define SHOW_ERASE_INFO
 
-/* Declartion of static environments */
-/* envs[0]: global environment, envs[n]: static local environment, for example:
- * in the global environment: 
+/* Declartion of environments */
+/* envs[0]: global environment, envs[n]: frames of procedures being called,
+ * for example: in the global environment:
  * 1. "(define a 3)" --> envs[0]["a"] = 3, "a" is defined in the
  *	  global environment;
  * 2. "(define (func a b)
  *	     (define c 4)
- *       (+ a b c))"6
- *    --> envs[0]["func"] = <compound procedure: func>, envs[1]["c"] = 4,
- *    "c" is defined in the static local environment.
- * 3. when apply_proc() return, remove static local environment from envs.
+ *       (+ a b c))"
+ *    --> envs[0]["func"] = <compound procedure: func>, a call of func
+ *    pushes a frame envs[1] of a, b and c, "c" is defined in the frame.
+ * 3. when apply_proc() return, remove the frame from envs.
+ * Variables are looked up in envs.back() and its parents, see Frame.
+ * Each interpreter has its own envs, see Interpreter.
  */
-static Environment envs;
 
-/* Initialize/reset the global environment. */
+/* Interpreter of current thread, see InterpreterScope */
+static thread_local Interpreter* current = nullptr;
+
+/* Return the interpreter of current thread */
+Interpreter& current_interpreter()
+{
+	if (current == nullptr)
+		error_handler("ERROR(scheme): no interpreter in current thread");
+	return *current;
+}
+
+/* cons_allocated when the pairs were counted last time */
+static thread_local size_t cons_mark = 0;
+
+/* Pairs allocated by current thread are counted when the interpreter of
+ * current thread changes, so the counter of pairs is a plain thread_local.
+ */
+void update_cons_count()
+{
+	if (current != nullptr && current->stats)
+		current->stats->add_cons(cons_allocated - cons_mark);
+	cons_mark = cons_allocated;
+}
+
+InterpreterScope::InterpreterScope(Interpreter& interp) : saved(current)
+{
+	update_cons_count();
+	current = &interp;
+}
+
+/* Restore the interpreter of current thread */
+InterpreterScope::~InterpreterScope()
+{
+	update_cons_count();
+	current = saved;
+}
+
+/* Number of kept frames which starts the first collect_frames() */
+static const size_t COLLECT_FRAMES_MIN = 1024;
+
+/* The global environment is copied, so threads don't share it, but
+ * procedures and the frames where they were created are shared. Frames of
+ * the procedures being called aren't needed, procedures find variables in
+ * their own frames.
+ */
+Interpreter::Interpreter(const Interpreter& other) :
+	collect_limit(COLLECT_FRAMES_MIN), load_depth(other.load_depth),
+	keywords_shadowed(other.keywords_shadowed), loop_jump(-1),
+	macros(other.macros), input_port(other.input_port),
+	output_port(other.output_port), profiler(other.profiler),
+	call_stack(other.call_stack), stats(other.stats)
+{
+	envs.push_back(make_shared<Frame>(*other.envs[0]));
+}
+
+/* Current thread evaluates in a copy of parent */
+WorkerState::WorkerState(const Interpreter& parent) :
+	worker(parent), scope(worker)
+{
+	running_threads++;
+}
+
+WorkerState::~WorkerState()
+{
+	running_threads--;
+}
+
+/* Ports of std::cin and std::cout, which are not owned by interpreters */
+template <typename T>
+static shared_ptr<T> standard_port(T& port)
+{
+	return shared_ptr<T>(&port, [](T*) {});
+}
+
+Interpreter::Interpreter() : collect_limit(COLLECT_FRAMES_MIN), load_depth(0),
+	keywords_shadowed(false), loop_jump(-1),
+	input_port(standard_port(standard_input_port())),
+	output_port(standard_port(standard_output_port()))
+{
+	reset();
+}
+
+/* Initialize/reset the global environment of current interpreter. */
 void initialize_environment()
 {
+	current_interpreter().reset();
+}
+
+/* Initialize/reset the global environment. */
+void Interpreter::reset()
+{
+	InterpreterScope scope(*this);
+	if (!envs.empty())
+		remove_frames(*this, 1);
 	envs.clear();
-	envs.push_back(SubEnv());
+	envs.push_back(make_shared<Frame>());
+	keywords_shadowed = false;
+	loops.clear();
+	loop_jump = -1;
+	macros = builtin_macros();
 
-	static vector <pair<string, Object(*)(vector<Object>&)>> procs{
+	static vector <pair<string, Object(*)(const vector<Object>&)>> procs{
 		make_pair("number?", Primitive::is_number),
 		make_pair("integer?", Primitive::is_integer),
 		make_pair("boolean?", Primitive::is_boolean),
@@ -44,9 +140,7 @@ void initialize_environment()
 		make_pair("abs", Primitive::abs),
 		make_pair("square", Primitive::square),
 		make_pair("sqrt", Primitive::sqrt),
-		make_pair("not", Primitive::not),
-		make_pair("or", Primitive:: or ),
-		make_pair("and", Primitive::and),
+		make_pair("not", Primitive::op_not),
 
 		make_pair("<", Primitive::less),
 		make_pair("<=", Primitive::lessEqual),
@@ -65,7 +159,32 @@ void initialize_environment()
 		make_pair("exit", Primitive::quit),
 		make_pair("reset", Primitive::reset),
 		make_pair("display", Primitive::display),
+		make_pair("write", Primitive::write),
 		make_pair("newline", Primitive::newline),
+		make_pair("flush-output-port", Primitive::flush_output_port),
+		make_pair("write-string", Primitive::write_string),
+		make_pair("write-char", Primitive::write_char),
+
+		make_pair("open-input-file", Primitive::open_input_file),
+		make_pair("open-output-file", Primitive::open_output_file),
+		make_pair("open-input-string", Primitive::open_input_string),
+		make_pair("open-output-string", Primitive::open_output_string),
+		make_pair("get-output-string", Primitive::get_output_string),
+		make_pair("close-port", Primitive::close_port),
+		make_pair("close-input-port", Primitive::close_port),
+		make_pair("close-output-port", Primitive::close_port),
+		make_pair("read-line", Primitive::read_line),
+		make_pair("read-char", Primitive::read_char),
+		make_pair("peek-char", Primitive::peek_char),
+		make_pair("read", Primitive::read),
+		make_pair("eof-object", Primitive::eof_object),
+		make_pair("eof-object?", Primitive::is_eof_object),
+		make_pair("input-port?", Primitive::is_input_port),
+		make_pair("output-port?", Primitive::is_output_port),
+		make_pair("current-input-port", Primitive::current_input_port),
+		make_pair("current-output-port", Primitive::current_output_port),
+		make_pair("call-with-output-file", Primitive::call_with_output_file),
+		make_pair("call-with-input-file", Primitive::call_with_input_file),
 		make_pair("load", Primitive::load),
 
 		make_pair("cons", Primitive::make_cons),
@@ -78,15 +197,54 @@ void initialize_environment()
 		make_pair("cddr", Primitive::cddr),
 		make_pair("append", Primitive::append),
 		make_pair("length", Primitive::length),
+		make_pair("list-ref", Primitive::list_ref),
+		make_pair("member", Primitive::member),
+		make_pair("assoc", Primitive::assoc),
+		make_pair("assq", Primitive::assq),
+		make_pair("sort", Primitive::sort),
+		make_pair("list-sort", Primitive::list_sort),
+		make_pair("string?", Primitive::is_string),
+		make_pair("string-length", Primitive::string_length),
+		make_pair("string-ref", Primitive::string_ref),
+		make_pair("substring", Primitive::substring),
+		make_pair("string-append", Primitive::string_append),
+		make_pair("string=?", Primitive::string_equal),
+		make_pair("string<?", Primitive::string_less),
+		make_pair("string->number", Primitive::string_to_number),
+		make_pair("number->string", Primitive::number_to_string),
+		make_pair("string-split", Primitive::string_split),
+		make_pair("string-index", Primitive::string_index),
 		make_pair("map", Primitive::map),
 		make_pair("for-each", Primitive::for_each),
+		make_pair("apply", Primitive::apply),
+		make_pair("parallel-map", Primitive::parallel_map),
+		make_pair("parallel-for-each", Primitive::parallel_for_each),
+		make_pair("spawn", Primitive::spawn),
+		make_pair("thread-join", Primitive::thread_join),
+		make_pair("make-channel", Primitive::make_channel),
+		make_pair("channel-put", Primitive::channel_put),
+		make_pair("channel-get", Primitive::channel_get),
+		make_pair("channel-close", Primitive::channel_close),
+		make_pair("call/cc", Primitive::call_cc),
+		make_pair("call-with-current-continuation", Primitive::call_cc),
+		make_pair("dynamic-wind", Primitive::dynamic_wind),
+		make_pair("profile-start", Primitive::profile_start),
+		make_pair("profile-stop", Primitive::profile_stop),
+		make_pair("profile-report", Primitive::profile_report),
+		make_pair("profile-folded", Primitive::profile_folded),
+		make_pair("runtime-stats-start", Primitive::runtime_stats_start),
+		make_pair("runtime-stats", Primitive::runtime_stats),
+		make_pair("runtime-stats-json", Primitive::runtime_stats_json),
+		make_pair("trace-start", Primitive::trace_start),
+		make_pair("trace-stop", Primitive::trace_stop),
+		make_pair("trace-dump", Primitive::trace_dump),
 
 	};
 
 	for (auto &proc : procs)
-		envs[0][proc.first] = Object(Procedure(proc.second, proc.first));
-	envs[0]["#t"] = Object(true);
-	envs[0]["#f"] = Object(false);
+		envs[0]->vars[proc.first] = Object(Procedure(proc.second, proc.first));
+	envs[0]->vars["#t"] = Object(true);
+	envs[0]->vars["#f"] = Object(false);
 
 	/* Preheating evaluator */
 	load_code(string("(define (f) (+ 1 2))\n"));
@@ -103,20 +261,32 @@ void reset_evaluator()
 /* Print Scheme prompt for input. */
 static inline void prompt()
 {
-	cout << ">>> Eval input: " << endl;
+	OutputPort& port = *current_interpreter().output_port;
+	lock_guard<mutex> guard(port.get_lock());
+	port.put(">>> Eval input: \n");
+	port.flush();
 }
 
-/* Evaluator start. */
-void run_evaluator(istream& in, int mode)
+/* Evaluator start in interp, return the value of the last expression. */
+Object run_evaluator(Interpreter& interp, istream& in, int mode)
 {
+	InterpreterScope scope(interp);
+	return run_evaluator(in, mode);
+}
+
+/* Evaluator start, return the value of the last expression. */
+Object run_evaluator(istream& in, int mode)
+{
+	Environment& envs = current_interpreter().envs;
 	/* Keep only the global environment */
 	if (envs.size() > 1) {
 #ifdef SHOW_ERASE_INFO
 		cout << "erase 1";
 #endif
-		envs.erase(envs.begin() + 1, envs.end());
+		remove_frames(current_interpreter(), 1);
 	}
 
+	Object result;
 	while (in.good()) {
 		if (mode == 0) 
 			prompt();
@@ -125,349 +295,712 @@ void run_evaluator(istream& in, int mode)
 			continue;
 
 		vector<string> split = split_input(input);
-		Object result = eval(split);
-		print_result(result, mode);
+		try {
+			result = eval(split);
+			print_result(result, mode);
+		}
+		catch (const SchemeError& e) {
+			/* Errors of files are handled by the one who loads them */
+			if (mode != 0)
+				throw;
+			report_error(e.what());
+			/* Remove environments of procedures which haven't returned */
+			remove_frames(current_interpreter(), 1);
+		}
 	}
 
-	return;
+	return result;
 }
 
-/* split = {"(", "+", "1", "2", ")", "3", "4"} 
- * --> call get_subexp(split) will return {"(", "+", "1", "2", ")"};
- * --> then, call get_single(split) will return "3".
- */
-/* Get subexpression */
-static vector<string> get_subexp(vector<string>& split)
+/* Evaluate all expressions of code in the interpreter */
+Object Interpreter::eval_string(const string& code)
 {
-	int cntParantheses = 1, i = 1;
-	for (; i < split.size() && cntParantheses != 0; i++) {
-		split[i] == ")" ? cntParantheses-- : 1;
-		split[i] == "(" ? cntParantheses++ : 1;
+	InterpreterScope scope(*this);
+	size_t depth = envs.size();
+	istringstream iss(code + "\n");
+	Object result;
+	try {
+		while (iss.good()) {
+			string input = get_input(iss);
+			if (!input.empty())
+				result = eval(split_input(input));
+		}
+	}
+	catch (...) {
+		/* Remove environments of procedures which haven't returned */
+		remove_frames(*this, depth);
+		throw;
 	}
-	vector<string> result(split.begin(), split.begin() + i);
-	split.erase(split.begin(), split.begin() + i);
-
 	return result;
 }
 
-/* Get a single variable */
-static string get_single(vector<string>& split)
+/* Call proc with args in the interpreter */
+Object Interpreter::call(const Object& proc, const vector<Object>& args)
 {
-	string result = split[0];
-	split.erase(split.begin());
+	InterpreterScope scope(*this);
+	size_t depth = envs.size();
+	try {
+		return apply_proc(proc, args);
+	}
+	catch (...) {
+		remove_frames(*this, depth);
+		throw;
+	}
+}
+
+Object Interpreter::call(const string& name, const vector<Object>& args)
+{
+	return call(lookup(name), args);
+}
+
+void Interpreter::define(const string& name, const Object& value)
+{
+	if (special_form(name) != NOT_SPECIAL)
+		keywords_shadowed = true;
+	envs[0]->vars[name] = value;
+}
+
+void Interpreter::define_procedure(const string& name,
+	Procedure::PrimitiveFunc func)
+{
+	define(name, Object(Procedure(std::move(func), name)));
+}
+
+Object Interpreter::lookup(const string& name)
+{
+	InterpreterScope scope(*this);
+	return eval_variable(name);
+}
+
+/* Helpers to walk the data built by read_datum(), the results are valid
+ * while ob is alive, constants of expressions are never copied to walk
+ * them.
+ */
+static inline const Object& car(const Object& ob) { return ob.get_cons()->car(); }
+static inline const Object& cdr(const Object& ob) { return ob.get_cons()->cdr(); }
+static inline const Object& cadr(const Object& ob) { return car(cdr(ob)); }
+static inline const Object& cddr(const Object& ob) { return cdr(cdr(ob)); }
+static inline Object make_nil() { return Object("nil", NIL); }
+
+/* Return true if ob is a list whose first element is the symbol tag */
+static inline bool is_tagged(const Object& ob, const string& tag)
+{
+	return ob.get_type() == CONS && car(ob).get_type() == SYMBOL &&
+		car(ob).get_string() == tag;
+}
+
+/* Evaluating expressions: read all data in split and evaluate them in order,
+ * return the value of the last one.
+ */
+Object eval(const vector<string>& split)
+{
+	Object result;
+	size_t pos = 0;
+	while (pos < split.size())
+		result = eval(expand(read_datum(split, pos)));
 
 	return result;
 }
 
-/* Delete parentheses of two ends */
-static void delete_ends_parentheses(vector<string>& split)
+/* Threads evaluating in copies of interpreters, see eval.h */
+atomic<int> running_threads(0);
+
+/* Locks of frames shared by threads, a frame uses one of them by its address */
+static mutex frame_locks[64];
+
+/* Return the lock of a frame which may be shared by threads, null while no
+ * thread is running.
+ */
+static inline mutex* shared_frame_lock(const Frame* frame)
 {
-	if (split.empty())
-		return;
+	if (running_threads.load(memory_order_acquire) == 0)
+		return nullptr;
+	return &frame_locks[reinterpret_cast<uintptr_t>(frame) / sizeof(Frame) % 64];
+}
+
+/* Return the lock of frame if it may be accessed by other threads: while
+ * threads are running, frames are locked except the global environment of
+ * current interpreter and a current frame which isn't kept by closures.
+ */
+static inline mutex* frame_lock(const Environment& envs, const Frame* frame)
+{
+	if (frame == envs[0].get() ||
+		(frame == envs.back().get() && envs.back().use_count() == 1))
+		return nullptr;
+	return shared_frame_lock(frame);
+}
 
-	if (split[0] == "(") {
-		split.pop_back();
-		split.erase(split.begin());
+/* Look for variables in the current frame(envs.back()) and its parents,
+ * then in the global environment, and call f with the variable under the
+ * lock of its frame; return false if name is unbound.
+ */
+template <typename Func>
+static bool find_variable(const Environment& envs, const string& name, Func f)
+{
+	Frame* global = envs[0].get();
+	Frame* frame = envs.back().get();
+	for (;;) {
+		mutex* lock = frame_lock(envs, frame);
+		unique_lock<mutex> guard;
+		if (lock != nullptr)
+			guard = unique_lock<mutex>(*lock);
+		auto found = frame->vars.find(name);
+		if (found != frame->vars.end()) {
+			f(found->second);
+			return true;
+		}
+		if (frame == global)
+			return false;
+		frame = frame->parent ? frame->parent.get() : global;
 	}
 }
 
+/* Bind name to value in the current frame, under the lock of the frame */
+static void bind_variable(const Environment& envs, const string& name,
+	Object value)
+{
+	mutex* lock = frame_lock(envs, envs.back().get());
+	unique_lock<mutex> guard;
+	if (lock != nullptr)
+		guard = unique_lock<mutex>(*lock);
+	envs.back()->vars[name] = std::move(value);
+}
+
+static inline bool is_bound(const Environment& envs, const string& name)
+{
+	return find_variable(envs, name, [](Object&) {});
+}
+
+/* Return the frame captured by procedures created now, null in the global
+ * environment.
+ */
+static inline shared_ptr<Frame> current_frame(const Environment& envs)
+{
+	return envs.size() == 1 ? nullptr : envs.back();
+}
+
+int special_form(const string& name)
+{
+	static const unordered_map<string, int> forms{
+		{ "define", SF_DEFINE }, { "if", SF_IF }, { "set!", SF_SET },
+		{ "lambda", SF_LAMBDA }, { "begin", SF_BEGIN }, { "quote", SF_QUOTE },
+		{ "quasiquote", SF_QUASIQUOTE }, { "and", SF_AND }, { "or", SF_OR },
+		{ "when", SF_WHEN }, { "unless", SF_UNLESS },
+		{ "case-lambda", SF_CASE_LAMBDA }, { "%loop", SF_LOOP }, { "%loop-next", SF_LOOP_NEXT }
+	};
+	auto it = forms.find(name);
+	return it == forms.end() ? NOT_SPECIAL : it->second;
+}
+
 /* Evaluating a expression. */
-Object eval(vector<string>& split)
+Object eval(Interpreter& interp, const Object& exp)
 {
-	if (split.empty())
-		return Object();
+	InterpreterScope scope(interp);
+	return eval(expand(exp));
+}
+
+Object eval(const Object& exp)
+{
+	switch (exp.get_type()) {
+	/* Self-evaluating, such as number, string, bool */
+	case INTEGER: case REAL: case BOOLEAN: case STRING: case CHAR: case NIL:
+		return exp;
+	/* KEYWORD or PROCEDURE(or variable) */
+	case SYMBOL:
+		return eval_variable(exp.get_string());
+	/* Free identifier of a macro template */
+	case KEYWORD:
+		return eval_global(exp);
+	case CONS:
+		break;
+	default:
+		error_handler("ERROR(scheme): unknown expression type -- " +
+			exp.get_type_str());
+	}
+
+	/* Special form, unless its keyword is bound as a variable; a keyword
+	 * of a macro template is never shadowed.
+	 */
+	const Object& first = car(exp);
+	int form = first.get_type() == SYMBOL || first.get_type() == KEYWORD ?
+		first.get_special_form() : NOT_SPECIAL;
+	if (form != NOT_SPECIAL && (first.get_type() == KEYWORD ||
+		!(current_interpreter().keywords_shadowed &&
+		is_bound(current_interpreter().envs, first.get_string()))))
+		return eval_keyword(form, cdr(exp));
 
 	/* Check if expression is a procedure, for example:
 	 * "(define (f) (+ 1 2))" --> "f" is a variable, "(f)" is a procedure;
 	 * when we input "f", evaluator will print "<compound procedure>",
 	 * and input "(f)", evaluator will return "3".
 	 */
-	int is_proc = 0;
-	if (split[0] == "(") {
-		is_proc = 1;
-		delete_ends_parentheses(split);
-	}
-	if (is_proc == 0 && split.size() == 1) {
-		return eval(split[0]); /* Evaluate a variable */
-	}
-	else {
-		/* Evaluate operator */
-		Object op;
-		if (split[0] == "(") {
-			/* "lambda" anonymous function, for example: 
-			 * "((lambda a (+ a 3)) 3)", "(lambda a (+ a 3))" is a procedure, 
-			 * and it's arguments is "3".
-			 */
-			vector<string> subexp = get_subexp(split);
-			op = eval(subexp);
-		}
-		else {
-			op = eval(get_single(split));
-		}
+	/* Evaluate operator, it could be a "lambda" anonymous function, such as
+	 * "((lambda (a) (+ a 3)) 3)", "(lambda (a) (+ a 3))" is a procedure,
+	 * and it's arguments is "3".
+	 */
+	Object op = eval(first);
+#ifdef SCHEME_DEBUG
+	cout << "DEBUG eval(): op.type: " << op.get_type() << endl;
+#endif
+	/* If op is a keyword, such as (define x if) (x #t 1 2), goto
+	 * eval_keyword()
+	 */
+	if (op.get_type() == KEYWORD)
+		return eval_keyword(op.get_special_form(), cdr(exp));
+
+	/* Else evaluate arguments of the procedure */
+	/* "(display (* 1 2) (+ 3 4))" -> "(* 1 2)" is subexpreession */
+	vector<Object> args;
+	for (const Object* rest = &cdr(exp); rest->get_type() == CONS; 
+		rest = &cdr(*rest))
+		args.push_back(eval(car(*rest)));
 
-#ifndef NDEBUG
-		cout << "DEBUG eval(): op.type: " << op.get_type() << endl;
+	return apply_proc(op, args);	/* Call op with args */
+}
+
+/* Evaluating a variable. */
+/* example: "(define a 3)" --> variable: a, add "a" to envs, envs["a"] = 3 */
+Object eval_variable(const string& str)
+{
+	Environment& envs = current_interpreter().envs;
+#ifdef SCHEME_DEBUG
+	cout << "DEBUG eval(): " << str << " " << envs.size() << endl;
 #endif
-		/* If op is a keyword, goto eval_keywords() */
-		if (op.get_type() == KEYWORD) {
-			return eval_keyword(op.get_string(), split);
-		}
+	Object value;
+	if (find_variable(envs, str, [&value](Object& var) { value = var; }))
+		return value;
+	/* Unbound keyword is evaluated to itself */
+	if (special_form(str) != NOT_SPECIAL)
+		return Object(str, KEYWORD);
+	string error_msg("ERROR(scheme): unknown symbol -- ");
+	error_msg += str;
+#ifdef SCHEME_DEBUG
+	error_msg += "\nDEBUG: Object eval_variable(const string& str)";
+#endif
+	error_handler(error_msg);
+	return Object();
+}
 
-		/* Else evaluate arguments of the procedure */
-		vector<Object> args;
-		while (!split.empty()) {
-			/* Evaluate a subexpression, example: */
-			/* "(display (* 1 2) (+ 3 4))" -> "(* 1 2)" is subexpreession */
-			if (split[0] == "(") {
-				args.push_back(eval(get_subexp(split)));
-			}
-			/* Self-evaluating, such as number, string, bool */
-			else {
-				args.push_back(eval(get_single(split)));
-			}
-		}
-		return apply_proc(op, args);	/* Call op with args */
+/* Evaluating a free identifier of a macro template, such as "equal?" in the
+ * expansion of case: it's looked up in the global environment, where macros
+ * are defined, so the variables of the caller don't capture it.
+ */
+Object eval_global(const Object& exp)
+{
+	/* Keyword used as a value, such as (define x if) */
+	if (exp.get_special_form() != NOT_SPECIAL)
+		return exp;
+	SubEnv& global = current_interpreter().envs[0]->vars;
+	auto found = global.find(exp.get_string());
+	if (found == global.end())
+		error_handler("ERROR(scheme): unknown symbol -- " + exp.get_string());
+	return found->second;
+}
+
+/* Return true if frame is referenced only by envs and by procedures of its
+ * own variables, such as helpers defined in a procedure body, which keep
+ * the frame where they were created directly or by frames of their own.
+ */
+static bool is_unreachable(const shared_ptr<Frame>& frame)
+{
+	long refs = frame.use_count() - 1;
+	for (auto &pair : frame->vars) {
+		const Object& value = pair.second;
+		if (value.get_type() != PROCEDURE || value.get_proc().use_count() != 1)
+			continue;
+		const shared_ptr<Frame>* link = &value.get_proc()->get_env();
+		while (*link && *link != frame && link->use_count() == 1)
+			link = &(*link)->parent;
+		if (*link == frame)
+			refs--;
 	}
+	return refs == 0;
 }
 
-/* Evaluating a single object. */
-Object eval(string& str)
+/* Clear the kept frames which have become unreachable, such as the frame
+ * of a closure returned with the helpers defined beside it, after the
+ * closure is dropped. Frames may be shared while threads are running, so
+ * they are checked later.
+ */
+static void collect_frames(Interpreter& interp)
 {
-	/* NUMBER or REAL */
-	if (isdigit(str[0]) || (str.size() > 1 && str[0] == '-' && isdigit(str[1])))
-	{
-		if (str.find('.') != string::npos) {
-#ifndef NDEBUG
-			cout << "DEBUG eval() NUMBER or REAL: " << str.find('.') << endl;
-#endif
-			return Object(stod(str));
-		}
+	if (running_threads.load(memory_order_acquire) != 0)
+		return;
+	vector<weak_ptr<Frame>>& kept = interp.kept_frames;
+	size_t n = 0;
+	for (size_t i = 0; i < kept.size(); i++) {
+		shared_ptr<Frame> frame = kept[i].lock();
+		if (frame == nullptr)
+			continue;
+		if (is_unreachable(frame))
+			frame->vars.clear();
 		else
-			return Object(stoi(str));
+			kept[n++] = kept[i];
 	}
-	/* STRING */
-	else if (str[0] == '"') {
-		return Object(str);
+	kept.resize(n);
+	interp.collect_limit = max(COLLECT_FRAMES_MIN, 2 * n);
+}
+
+/* Remove a frame from envs, the cycle of a frame and its procedures is
+ * broken if nothing else refers to them; a frame kept by closures is
+ * checked again by collect_frames().
+ */
+static inline void pop_frame(Interpreter& interp)
+{
+	shared_ptr<Frame> frame = std::move(interp.envs.back());
+	interp.envs.pop_back();
+	if (frame.use_count() == 1)
+		return;
+	/* Closures of the frame may be running in other threads, such as set!
+	 * of a captured variable; variables are destroyed out of the lock.
+	 */
+	SubEnv unreachable;
+	bool cleared;
+	{
+		mutex* lock = shared_frame_lock(frame.get());
+		unique_lock<mutex> guard;
+		if (lock != nullptr)
+			guard = unique_lock<mutex>(*lock);
+		cleared = is_unreachable(frame);
+		if (cleared)
+			unreachable.swap(frame->vars);
 	}
-	/* Symbol */
-	else if (str[0] == '\'')
-		return Object(str);
-	/* KEYWORD or PROCEDURE(or variable) */
-	/* example: "(define a 3)" --> variable: a, add "a" to envs, envs["a"] = 3 */
-	else {
-		if (find(keywords.begin(), keywords.end(), str) != keywords.end()) {
-			return Object(str, KEYWORD);
-		}
-		else {
-			/* Look for variables in each environment from the 
-			 * last environment(local) to the first one(global) 
-			 */
-#ifndef NDEBUG
-			cout << "DEBUG eval(): " << str << " " << envs.size() << endl;
-#endif
-			for (auto it = envs.rbegin(); it != envs.rend(); ++it) {
-#ifdef SHOW_ITERATOR_INFO
-				cout << "iterator 1" << endl;
-#endif
-				if (it->find(str) != it->end())
-					return (*it)[str];
-			}
-			string error_msg("ERROR(scheme): unknown symbol -- ");
-			error_msg += str;
-#ifndef NDEBUG
-			error_msg += "\nDEBUG: Object eval(string& str)";
-#endif
-			error_handler(error_msg);
-		}
+	if (!cleared) {
+		interp.kept_frames.push_back(frame);
+		if (interp.kept_frames.size() >= interp.collect_limit)
+			collect_frames(interp);
 	}
 }
 
-/* Add new_env(static environment of proc) to envs */
-static inline void expand_env(unordered_map<string, Object>& new_env) {
-	envs.push_back(new_env);
+static inline void remove_env(void) {
+	Interpreter& interp = current_interpreter();
+	if (interp.envs.size() > 1)
+		pop_frame(interp);
 }
 
-/* Remove a environment from envs */
-static inline void remove_env(void) {
-	if (envs.size() > 1)
-		envs.pop_back();
+/* Remove the frames above depth, such as frames of procedures which
+ * haven't returned because of errors.
+ */
+void remove_frames(Interpreter& interp, size_t depth)
+{
+	while (interp.envs.size() > depth && interp.envs.size() > 1)
+		pop_frame(interp);
+}
+
+/* Break the cycles of frames and closures of the interpreter, clearing a
+ * frame may make the frames of its closures unreachable.
+ */
+Interpreter::~Interpreter()
+{
+	remove_frames(*this, 1);
+	if (!envs.empty())
+		envs[0]->vars.clear();
+	size_t kept;
+	do {
+		kept = kept_frames.size();
+		collect_frames(*this);
+	} while (kept_frames.size() < kept);
 }
 
+/* Frame of the call stack, kept only when profiling or collecting
+ * statistics.
+ */
+class CallFrame {
+public:
+	CallFrame(Interpreter& in, const Procedure& proc) :
+		interp(in), pushed(in.profiler != nullptr), stats(in.stats),
+		name(proc.get_proc_name()) {
+		if (stats)
+			start = stats->enter(name);
+		if (tracing())
+			trace_record(TRACE_CALL, name);
+		/* Time before the call belongs to the caller */
+		if (pushed) {
+			interp.profiler->poll(interp.call_stack);
+			interp.call_stack.push_back(&proc.get_proc_name());
+		}
+	}
+	/* Sample before the procedure returns, used by long primitives */
+	void poll() {
+		if (interp.profiler)
+			interp.profiler->poll(interp.call_stack);
+	}
+	~CallFrame() {
+		if (tracing())
+			trace_record(TRACE_RETURN, name);
+		if (pushed)
+			interp.call_stack.pop_back();
+		if (stats)
+			stats->leave(name, start);
+	}
+private:
+	Interpreter&	interp;
+	bool			pushed;	/* Procedure is pushed into call_stack */
+	shared_ptr<RuntimeStats>	stats;
+	const string&	name;
+	RuntimeStats::Clock::time_point	start;
+};
+
 /* Call proc with obs. */
-Object apply_proc(Object &op, vector<Object>& obs)
+Object apply_proc(const Object &op, const vector<Object>& obs)
 {
 	if (op.get_type() != PROCEDURE) {
-#ifndef NDEBUG
+#ifdef SCHEME_DEBUG
 		cout << "DEBUG: Object apply_proc(Object &proc, vector<Object>& obs)\n";
 #endif
 		error_handler("ERROR: unknown procedure -- apply_proc()");
 	}
 	/* Handler with procedures */
 	shared_ptr<Procedure> proc = op.get_proc();
+	Interpreter& interp = current_interpreter();
+	CallFrame frame(interp, *proc);
 	/* Primitive procedure */
-	if (proc->get_type() == PRIMITIVE)
-		return proc->get_primitive()(obs);
-	/* Compound procedure -- lambda procedure */
-	else if (proc->get_type() == COMPOUND) {
-		vector<string> parameters(proc->get_parameters());
-		/* The number of parameters is not equal the number of arguments */
-		if (parameters.size() != obs.size()) {
-			string error_msg("ERROR(scheme): the procedure has been "
-				"called with ");
-			error_msg.push_back(obs.size() + '0');
-			error_msg += " arguments, it requires exactly ";
-			error_msg.push_back(parameters.size() + '0');
-			error_msg += " arguments -- ";
-			error_msg += proc->get_proc_name();
-			error_handler(error_msg);
-		}
-
-		/* Get static environment of proc */
-		SubEnv proc_env = proc->get_env();
-		for (int i = 0; i < parameters.size(); i++) {
-			proc_env[parameters[i]] = obs[i]; /* Bind arguments to parameters */
-		}
+	if (proc->get_type() == PRIMITIVE) {
+		Object result = proc->get_primitive()(obs);
+		frame.poll();
+		return result;
+	}
+	/* Compound procedure -- lambda procedure, or a clause of case-lambda */
+	const Procedure* lambda = proc.get();
+	if (!proc->get_clauses().empty()) {
+		lambda = nullptr;
+		for (auto &clause : proc->get_clauses())
+			if (clause->accepts(obs.size())) {
+				lambda = clause.get();
+				break;
+			}
+		if (lambda == nullptr)
+			error_handler("ERROR(scheme): no clause of case-lambda accepts " +
+				to_string(obs.size()) + " arguments -- " + proc->get_proc_name());
+	}
+	const vector<string>& parameters = lambda->get_parameters();
+	/* The number of parameters is not equal the number of arguments */
+	if (!lambda->accepts(obs.size())) {
+		error_handler("ERROR(scheme): the procedure has been called with " +
+			to_string(obs.size()) + " arguments, it requires " +
+			(lambda->has_rest() ? "at least " : "exactly ") +
+			to_string(parameters.size()) + " arguments -- " +
+			proc->get_proc_name());
+	}
 
-		expand_env(proc_env);
-		/* Evaluating in a expanded environment */
-		Object result = eval(proc->get_body());	
+	/* The frame of the call is linked to the frame where proc was created,
+	 * the names defined by the body are bound before it's evaluated(like
+	 * letrec*), so the frame has all of its slots and is never rehashed.
+	 */
+	const vector<string>& defines = lambda->get_defines();
+	auto env = make_shared<Frame>();
+	env->parent = proc->get_env();
+	env->vars.reserve(parameters.size() + lambda->has_rest() + defines.size());
+	for (size_t i = 0; i < parameters.size(); i++) {
+		env->vars[parameters[i]] = obs[i]; /* Bind arguments to parameters */
+	}
+	/* Extra arguments are consed onto the rest list from the last one */
+	if (lambda->has_rest()) {
+		Object rest = make_nil();
+		for (size_t i = obs.size(); i-- > parameters.size(); )
+			rest = Object(Cons(obs[i], rest));
+		env->vars[lambda->get_rest()] = std::move(rest);
+	}
+	for (auto &name : defines)
+		env->vars.emplace(name, Object());
 
-		/* Update static environment of proc */
-		proc_env = proc->get_env();
-		for (auto &pair : proc_env) {
-			proc->set_env(pair.first, envs.back()[pair.first]);
-		}
+	interp.envs.push_back(std::move(env));
+	if (interp.stats)
+		interp.stats->frame(interp.envs.size() - 1);
+	/* Evaluating in the frame */
+	Object result = eval_begin(lambda->get_body());	
 
-		/* Remove static environment of proc from envs */
-		remove_env();
+	/* Remove the frame from envs, closures created by the call keep it */
+	remove_env();
 
-		return result;
-	}
+	frame.poll();
+	return result;
 }
 
 /* Handle with keyword */
-Object eval_keyword(const string& keyword, vector<string>& exp)
+Object eval_keyword(int form, const Object& exp)
 {
 	/* Handler with keywords */
-	auto it = find(keywords.begin(), keywords.end(), keyword);
-	int keywords_index = it - keywords.begin();
-	switch (keywords_index) {
-	case (0): /* define expression */
+	switch (form) {
+	case SF_DEFINE:
 		return eval_define(exp);
-	case (1): /* if expression */
+	case SF_IF:
 		return eval_if(exp);
-	case (2): /* set expression */
+	case SF_SET:
 		return eval_set(exp);
-	case (3): /* lambda expression */
+	case SF_LAMBDA:
 		return eval_lambda(exp);
-	case (4): /* begin expression */
+	case SF_BEGIN:
 		return eval_begin(exp);
-	case (5): /* let expression */
-		return eval_let(exp);
-	case (6): /* cond expression */
-		return eval_cond(exp);
+	case SF_QUOTE:
+		return eval_quote(exp);
+	case SF_QUASIQUOTE:
+		return eval_quasiquote(exp);
+	case SF_AND:
+		return eval_and(exp);
+	case SF_OR:
+		return eval_or(exp);
+	case SF_WHEN:
+		return eval_when(exp, true);
+	case SF_UNLESS:
+		return eval_when(exp, false);
+	case SF_CASE_LAMBDA:
+		return eval_case_lambda(exp);
+	case SF_LOOP:
+		return eval_loop(exp);
+	case SF_LOOP_NEXT:
+		return eval_loop_next(exp);
 	default:
-#ifndef NDEBUG
-		cout << "DEBUG eval_keyword(): " << keyword << endl;
+#ifdef SCHEME_DEBUG
+		cout << "DEBUG eval_keyword(): " << form << endl;
 #endif
-		error_handler(string("ERROR(runtime): unknown keyword -- ") + keyword);
+		error_handler("ERROR(runtime): unknown keyword -- " + to_string(form));
 	}
-	// return Object(); /* Return null */
+	return Object(); /* Return null */
 }
 
 /* Handle with "define" expression, if define a compound procedure ,
  * convert to "lambda" expression, for example:
- * "(define (square x) (* x x))" --> exp: {"(square x)", "(* x x)"},
- * procedure name: "square", parameter: {"x"}, body: "(* x x)".
+ * "(define (square x) (* x x))" --> exp: ((square x) (* x x)),
+ * procedure name: "square", parameter: (x), body: ((* x x)).
  * Convert to: "(define square (lambda (x) (* x x)))"
  */
-Object eval_define(vector<string>& exp)
+Object eval_define(const Object& exp)
 {
-	if (exp.empty())
+	if (exp.get_type() != CONS)
 		error_handler(string("ERROR(scheme): illegal define expression"));
-#ifndef NDEBUG
-	cout << "DEBUG eval_define(): ";
-	for (auto &s : exp)
-		cout << s << " ";
-	cout << endl;
-#endif
+
 	/* Add a new definition to current environment,
 	 * or update a value of definition in current environment.
 	 */
-	Environment::iterator curr_env = envs.end() - 1;
-	string ret;
+	Interpreter& interp = current_interpreter();
+	Environment& envs = interp.envs;
+	Object target = car(exp);
 	/* Define a procedure, convert to "lambda" expression */
-	if (exp[0] == "(") {
-		string proc_name = exp[1];
-		ret = proc_name;
-		/* delete procedure name, {(square x), (* x x)} --> {(x), (* x x)} */
-#ifdef SHOW_ERASE_INFO
-		cout << "erase 5";
-#endif
-		exp.erase(exp.begin() + 1); 
-		(*curr_env)[proc_name] = eval_lambda(exp, proc_name);
+	if (target.get_type() == CONS) {
+		Object proc_name = car(target);
+		/* delete procedure name, ((square x) (* x x)) --> ((x) (* x x)) */
+		Object lambda_exp(Cons(cdr(target), cdr(exp)));
+		Object proc = eval_lambda(lambda_exp, proc_name.get_string());
+		bind_variable(envs, proc_name.get_string(), std::move(proc));
+		target = proc_name;
 	}
 	/* Define a common variable, such as (define a 3);
 	 * or define a procedure, such as (define square (lambda (x) (* x x))).
 	 */
-	else {
-		string variable = exp[0];
-		ret = variable;
-		(*curr_env)[variable] =
-			eval(vector<string>(exp.begin() + 1, exp.end()));
-	}
-#ifndef NDEBUG
-	cout << "DEBUG eval_define(): define OK " << endl;
+	else if (target.get_type() == SYMBOL) {
+		Object value = (cdr(exp).get_type() == CONS ? eval(cadr(exp)) : Object());
+		/* Evaluating value may reallocate envs, find current one after it */
+		bind_variable(envs, target.get_string(), std::move(value));
+	}
+	else
+		error_handler(string("ERROR(scheme): illegal define expression"));
+	if (target.get_special_form() != NOT_SPECIAL)
+		interp.keywords_shadowed = true;
+#ifdef SCHEME_DEBUG
+	cout << "DEBUG eval_define(): define OK " << target.get_string() << endl;
 #endif
-	return Object(ret);
+	return target;
+}
+
+/* Add the names defined by body to defines, such as "f" of
+ * "((define (f) (g)) (define (g) 1) (f))"; definitions in "begin" are
+ * definitions of the body too.
+ */
+static void scan_defines(const Object& body, vector<string>& defines)
+{
+	for (const Object* rest = &body; rest->get_type() == CONS;
+		rest = &cdr(*rest)) {
+		const Object& exp = car(*rest);
+		if (exp.get_type() != CONS || (car(exp).get_type() != SYMBOL &&
+			car(exp).get_type() != KEYWORD) || cdr(exp).get_type() != CONS)
+			continue;
+		int form = car(exp).get_special_form();
+		if (form == SF_BEGIN)
+			scan_defines(cdr(exp), defines);
+		else if (form == SF_DEFINE) {
+			const Object& target = cadr(exp);
+			const Object& name = target.get_type() == CONS ? car(target) : target;
+			if (name.get_type() == SYMBOL)
+				defines.push_back(name.get_string());
+		}
+	}
 }
 
 /* Handle with "lambda" expression, for example:
- * "(lambda (x) (+ x 3))" --> parameters: {"x"}, body: "(+ x 3)",
+ * "(lambda (x) (+ x 3))" --> parameters: {"x"}, body: ((+ x 3)),
+ * "(lambda (x . y) y)" and "(lambda y y)" --> rest parameter: "y".
  * Procedure constructor:
- *		Procedure(const vector<string>& params, const vector<string>& bdy);
+ *		Procedure(const vector<string>& params, const Object& bdy);
  * construct a compound procedure, and return it as an Object.
  */
-Object eval_lambda(vector<string>& exp, const string& proc_name)
+static Object make_lambda(const Object& exp, const string& proc_name,
+	shared_ptr<Frame> env)
 {
-	if (exp.empty() || exp[0] != "(")
+	if (exp.get_type() != CONS)
 		error_handler("ERROR(scheme): illegal lambda expression");
 
 	/* Split exp into parameters and body */
 	vector<string> parameters;
-	int i = 1;
-	for (; i < exp.size() && exp[i] != ")"; i++) {
-		parameters.push_back(exp[i]);
+	const Object* params = &car(exp);
+	for (; params->get_type() == CONS; params = &cdr(*params)) {
+		if (car(*params).get_type() != SYMBOL)
+			error_handler("ERROR(scheme): illegal lambda parameter");
+		if (car(*params).get_special_form() != NOT_SPECIAL)
+			current_interpreter().keywords_shadowed = true;
+		parameters.push_back(car(*params).get_string());
 	}
+	string rest;
+	if (params->get_type() == SYMBOL) {
+		if (params->get_special_form() != NOT_SPECIAL)
+			current_interpreter().keywords_shadowed = true;
+		rest = params->get_string();
+	}
+	else if (params->get_type() != NIL)
+		error_handler("ERROR(scheme): illegal lambda parameter");
+
+	/* The body is a sequence of expressions: (<exp1> <exp2> ... <expn>) */
+	Object body = cdr(exp);
 
-	/* Make the body a begin expression:"(begin <exp1> <exp2> ... <expn> )" */
-	vector<string> body{ "(", "begin", ")" };
-	body.insert(body.begin() + 2, exp.begin() + i + 1, exp.end());
+	/* Internal definitions of the body, they are bound in the frame of
+	 * each call before the body is evaluated.
+	 */
+	vector<string> defines;
+	scan_defines(body, defines);
 
 	/* Construct a compound procedure */
-	/* Note!!!: To store the values of local variables, the evaluator will 
-	 * establish an environment that holds these values, and store it at
-	 * class Procedure::static_env.
-	 * This implementation is not good, but it does work, 
-	 * using shared_ptr might be a better choice.
-	 * You can read SICP chapter 3.1 on page 152(Chinese version) or 
-	 * 300(English version) if you want.
+	return Object(Procedure(parameters, body, proc_name, std::move(env),
+		std::move(defines), rest));
+}
+
+Object eval_lambda(const Object& exp, const string& proc_name)
+{
+	/* The procedure shares the current frame(SICP chapter 3.2), the frames
+	 * of its calls are linked to it; the global environment isn't saved.
 	 */
-#if 1
-	/* No need to save global environment */
-	if (envs.size() == 1)
-		return Object(Procedure(parameters, body, proc_name));
-	else
-		return Object(Procedure(parameters, body, proc_name, envs.back()));
-#else
-	return Object(Procedure(parameters, body, proc_name));
-#endif
+	return make_lambda(exp, proc_name, current_frame(current_interpreter().envs));
+}
+
+/* Handle with "case-lambda" expression, every clause is a lambda expression
+ * without "lambda", such as "((x y) (+ x y))"; the clauses are evaluated in
+ * the frame of the case-lambda procedure, so they don't keep frames.
+ */
+Object eval_case_lambda(const Object& exp)
+{
+	vector<shared_ptr<Procedure>> clauses;
+	for (const Object* rest = &exp; rest->get_type() == CONS;
+		rest = &cdr(*rest))
+		clauses.push_back(make_lambda(car(*rest), "case-lambda", nullptr).get_proc());
+	if (clauses.empty())
+		error_handler("ERROR(scheme): ill-formed special form -- case-lambda");
+	return Object(Procedure(std::move(clauses), "*anonymous*",
+		current_frame(current_interpreter().envs)));
 }
 
 /* Return true if object is some kinds of "true",
  * Note: In Scheme, only "#f" is false, everything else is true. :) hopefully
  */
-bool is_true(Object& ob)
+bool is_true(const Object& ob)
 {
 	if (ob.get_type() == BOOLEAN)
 		return ob.get_boolean();
@@ -478,44 +1011,22 @@ bool is_true(Object& ob)
  * "(if (> a 2) (+ a 3) (- a 1))" --> exp: "(> a 2) (+ a 3) (- a 1)",
  * predicate: "(> a 2)", consequent: "(+ a 3)", alternative: "(- a 1)".
  */
-Object eval_if(vector<string>& exp) {
-	Object predicate, consequent, alternative;
-	/* Evaluate predicate */
-	if (exp.empty())
+Object eval_if(const Object& exp) {
+	if (exp.get_type() != CONS || cdr(exp).get_type() != CONS)
 		error_handler("ERROR(scheme): Ill-formed special -- if");
-	else if (exp[0] == "(") {
-		predicate = eval(get_subexp(exp));
-	}
-	else {
-		predicate = eval(get_single(exp));
-	}
 
-	if (exp.empty())
-		error_handler("ERROR(scheme): Ill-formed special -- if");
+	/* Evaluate predicate */
+	Object predicate = eval(car(exp));
+	const Object& rest = cdr(exp);
 
 	/* If predicate is true, return consequent */
-	if (is_true(predicate)) {
-		if (exp[0] == "(")
-			return eval(get_subexp(exp));
-		else {
-			return eval(get_single(exp));
-		}
-	}
+	if (is_true(predicate))
+		return eval(car(rest));
 	/* Else return alternative */
-	else {
-		/* Skip consequent */
-		if (exp[0] == "(")
-			get_subexp(exp);
-		else
-			get_single(exp);
-
-		if (exp.empty())	/* Alternative could be empty */
-			return Object();
-		else if (exp[0] == "(")
-			return eval(get_subexp(exp));
-		else
-			return eval(exp[0]);
-	}
+	const Object& alternative = cdr(rest);
+	if (alternative.get_type() != CONS)	/* Alternative could be empty */
+		return Object();
+	return eval(car(alternative));
 }
 
 /* Handler with "begin" expression, for example:
@@ -523,108 +1034,169 @@ Object eval_if(vector<string>& exp) {
  * First evaluate "(+ 1 2)", and then evaluate "(+ 3 4)", 
  * and return the last subexpression as the result.
  */
-Object eval_begin(vector<string>& exp)
+Object eval_begin(const Object& exp)
 {
 	Object result;
-	while (!exp.empty()) { /* Exp may be empty */
-		if (exp[0] == "(")
-			result = eval(get_subexp(exp));
-		else
-			result = eval(get_single(exp));
-	}
+	/* Exp may be empty */
+	for (const Object* rest = &exp; rest->get_type() == CONS; 
+		rest = &cdr(*rest))
+		result = eval(car(*rest));
 
 	return result;
 }
 
-/* Handler with "let" expression, convert "let" expression to "lambda" 
- * expression, for example:
- * (let ((<var1> <exp1>) ... (<var_n><exp_n>)) <body>)
- * --> ((lambda (<var1> ... <var_n>) <body>) <exp1> ... <exp_n>)
+/* Handler with "and" expression, for example:
+ * "(and (pair? x) (car x))" --> (car x) is evaluated only if x is a pair;
+ * return the first false value or the last value, (and) is #t.
  */
-Object eval_let(vector<string>& exp)
-{
-	if (exp.empty())
-		error_handler("ERROR(scheme): ill-formed special from: let");
-
-	/* Split exp into vars, exps and body */
-	vector<string> pairs_of_vars_and_exps = get_subexp(exp);
-	vector<string> body = exp;
-
-	vector<string> vars, exps;
-	delete_ends_parentheses(pairs_of_vars_and_exps);
-	while (!pairs_of_vars_and_exps.empty()) {
-		/* one_pair: (<var> <exp>) */
-		vector<string> one_pair = get_subexp(pairs_of_vars_and_exps); 
-		delete_ends_parentheses(one_pair);
-		assert(one_pair.size() >= 2);
-		vars.push_back(get_single(one_pair));
-		exps.insert(exps.end(), one_pair.begin(), one_pair.end());
-	}
-
-	/* Convert to "lambda" expression */
-	vector<string> lambda_exp{ "(", "(", "lambda", "(" };
-	lambda_exp.insert(lambda_exp.end(), vars.begin(), vars.end());
-	lambda_exp.push_back(")");
-	lambda_exp.insert(lambda_exp.end(), body.begin(), body.end());
-	lambda_exp.push_back(")");
-	lambda_exp.insert(lambda_exp.end(), exps.begin(), exps.end());
-	lambda_exp.push_back(")");
-	
-	/* Evaluate "lambda" expression */
-	return eval(lambda_exp);
-}
-
-/* Handler with "cond" expression, for example:
- * (cond ((> x 0) x)
- *		 ((= x 0) (display 'zero) 0)
- *		 (else (- x)))
- * In this example, "(> x 0)" and "(= x 0)" are predicates.
+Object eval_and(const Object& exp)
+{
+	Object result(true);
+	for (const Object* rest = &exp; rest->get_type() == CONS; 
+		rest = &cdr(*rest)) {
+		result = eval(car(*rest));
+		if (!is_true(result))
+			break;
+	}
+	return result;
+}
+
+/* Handler with "or" expression, return the first true value, (or) is #f */
+Object eval_or(const Object& exp)
+{
+	Object result(false);
+	for (const Object* rest = &exp; rest->get_type() == CONS; 
+		rest = &cdr(*rest)) {
+		result = eval(car(*rest));
+		if (is_true(result))
+			break;
+	}
+	return result;
+}
+
+/* Handler with "when" and "unless" expressions, for example:
+ * "(when (> x 0) (display x) x)" evaluates the body if the test is true,
+ * "unless" if it's false; otherwise the value is unspecified.
  */
-Object eval_cond(vector<string>& exp)
+Object eval_when(const Object& exp, bool condition)
 {
-	if (exp.empty())
-		error_handler("ERROR(scheme): ill-formed special -- cond");
+	if (exp.get_type() != CONS)
+		error_handler(string("ERROR(scheme): ill-formed special form -- ") +
+			(condition ? "when" : "unless"));
+	if (is_true(eval(car(exp))) != condition)
+		return Object();
+	return eval_begin(cdr(exp));
+}
 
-	/* If the first sub exp is "else" expression */
-	while (!exp.empty()) {
-		/* Get first clause */
-		vector<string> first_clause = get_subexp(exp);
-		delete_ends_parentheses(first_clause);
+/* Keep a running loop in interp.loops, it's removed when the loop exits,
+ * also by errors and escapes of continuations.
+ */
+class LoopScope {
+public:
+	LoopScope(Interpreter& in, LoopFrame loop) : interp(in) {
+		interp.loops.push_back(std::move(loop));
+	}
+	~LoopScope() { interp.loops.pop_back(); }
+private:
+	Interpreter&	interp;
+};
+
+/* Handler with named let, for example:
+ * "(let loop ((i 0)) (if (< i 3) (loop (+ i 1)) i))" is compiled to
+ * "(%loop 1 loop (i) (0) (if (< i 3) (%loop-next 1 (+ i 1)) i))";
+ * exp is the list of operands of %loop. The loop variables are bound in one
+ * frame, which is updated in place by each iteration, so iterations don't
+ * grow the stack or create frames. A frame captured by closures is kept by
+ * them, the next iteration gets a new one.
+ */
+Object eval_loop(const Object& exp)
+{
+	Interpreter& interp = current_interpreter();
+	int id = car(exp).get_integer();
+	const Object& tag = cadr(exp);
+	const Object& vars = car(cddr(exp));
+	const Object& body = cdr(cdr(cddr(exp)));
+
+	/* Evaluate initial values out of the loop */
+	auto frame = make_shared<Frame>();
+	frame->parent = current_frame(interp.envs);
+	const Object* init = &cadr(cddr(exp));
+	for (const Object* var = &vars; var->get_type() == CONS;
+		var = &cdr(*var), init = &cdr(*init))
+		frame->vars[car(*var).get_string()] = eval(car(*init));
+
+	interp.envs.push_back(std::move(frame));
+	if (interp.stats)
+		interp.stats->frame(interp.envs.size() - 1);
+	LoopScope scope(interp,
+		LoopFrame{ id, interp.envs.size() - 1, &tag, &vars, {} });
 
-		if (first_clause[0] == "else") {
-			if (exp.empty()) {
-#ifdef SHOW_ERASE_INFO
-				cout << "erase 6";
-#endif
-				/* Delete "else" */
-				first_clause.erase(first_clause.begin());
+	Object result;
+	for (;;) {
+		result = eval_begin(body);
+		/* The body returned without jumping back, or it jumped to an outer
+		 * loop whose body ends with this loop.
+		 */
+		if (interp.loop_jump != id)
+			break;
+		interp.loop_jump = -1;
+
+		/* The body has returned, so only closures may share the frame, they
+		 * may be running in other threads.
+		 */
+		LoopFrame& loop = interp.loops.back();
+		shared_ptr<Frame>& current = interp.envs[loop.env];
+		if (current.use_count() > 1) {
+			shared_ptr<Frame> copy;
+			{
+				mutex* lock = shared_frame_lock(current.get());
+				unique_lock<mutex> guard;
+				if (lock != nullptr)
+					guard = unique_lock<mutex>(*lock);
+				copy = make_shared<Frame>(*current);
 			}
-			else
-				/* There are exps after "else" expression */
-				error_handler("ERROR(scheme): else clause isn't last -- cond");
-		}
-		else {
-			/* Check if predicate is true */
-			Object predicate;
-			if (first_clause[0] == "(")
-				predicate = eval(get_subexp(first_clause));
-			else
-				predicate = eval(get_single(first_clause));
-
-			/* If predicate is false, evaluate next predicate */
-			if (!is_true(predicate))
-				continue;
-			/* Else goto following step */
+			current = std::move(copy);
 		}
+		auto value = loop.next.begin();
+		for (const Object* var = &vars; var->get_type() == CONS;
+			var = &cdr(*var), ++value)
+			current->vars[car(*var).get_string()] = std::move(*value);
+	}
+	remove_env();
+	return result;
+}
 
-		/* Make a "begin" expression */
-		vector<string> begin_exp{ "(", "begin", ")" };
-		begin_exp.insert(begin_exp.begin() + 2,
-			first_clause.begin(), first_clause.end());
-		return eval(begin_exp);
+/* Handler with "(%loop-next id arg ...)", which is in a tail position of
+ * the body of loop id: keep args for the loop variables, and return to the
+ * loop, which starts the next iteration.
+ */
+Object eval_loop_next(const Object& exp)
+{
+	Interpreter& interp = current_interpreter();
+	int id = car(exp).get_integer();
+	size_t index = interp.loops.size();
+	while (index > 0 && interp.loops[index - 1].id != id)
+		index--;
+	if (index-- == 0)
+		error_handler("ERROR(scheme): the loop isn't running -- %loop-next");
+
+	/* Arguments may run other loops, so the loop is found by its index */
+	interp.loops[index].next.clear();
+	for (const Object* rest = &cdr(exp); rest->get_type() == CONS;
+		rest = &cdr(*rest)) {
+		Object value = eval(car(*rest));
+		interp.loops[index].next.push_back(std::move(value));
 	}
 
-	/* If there is no "else" expression and no predicate is true, return null */
+	LoopFrame& loop = interp.loops[index];
+	size_t n = 0;
+	for (const Object* var = loop.vars; var->get_type() == CONS; var = &cdr(*var))
+		n++;
+	if (n != loop.next.size())
+		error_handler("ERROR(scheme): the procedure has been called with " +
+			to_string(loop.next.size()) + " arguments, it requires exactly " +
+			to_string(n) + " arguments -- " + loop.tag->get_string());
+	interp.loop_jump = id;
 	return Object();
 }
 
@@ -632,22 +1204,86 @@ Object eval_cond(vector<string>& exp)
  * "(set! <var> <exp>)" 
  * --> add <var> to current environment, or update it's value.
  */
-Object eval_set(vector<string>& exp)
+Object eval_set(const Object& exp)
 {
-	if (exp.empty()) {
+	if (exp.get_type() != CONS || cdr(exp).get_type() != CONS) {
 		error_handler("ERROR(scheme): ill-formed special form -- set!");
 	}
-	if (exp[0] == "(") {
+	if (car(exp).get_type() != SYMBOL && (car(exp).get_type() != KEYWORD ||
+		car(exp).get_special_form() != NOT_SPECIAL)) {
 		error_handler("ERROR(scheme): variable required, usage: " 
 			"(set! var value) -- set!");
 	}
-	string variable = get_single(exp);
+	string variable = car(exp).get_string();
 
-	Object ret = eval(exp);
-#if 1
-	Environment::iterator curr_env = envs.end() - 1;
-	(*curr_env)[variable] = ret;
-#endif
+	Object ret = eval(cadr(exp));
+	/* A free identifier of a macro template is a global variable */
+	if (car(exp).get_type() == KEYWORD) {
+		current_interpreter().envs[0]->vars[variable] = ret;
+		return ret;
+	}
+	/* Update the variable found by lexical scoping, such as a variable of
+	 * a closure shared by threads; a new variable is added to current
+	 * environment.
+	 */
+	Environment& envs = current_interpreter().envs;
+	if (!find_variable(envs, variable, [&ret](Object& var) { var = ret; }))
+		bind_variable(envs, variable, ret);
 
 	return ret;
-}
\ No newline at end of file
+}
+
+/* Handler with "quote" expression, for example:
+ * "'(a (b c))" --> "(quote (a (b c)))" --> the list (a (b c)).
+ * The datum was built by read_datum(), so it is returned as a constant
+ * without being constructed again.
+ */
+Object eval_quote(const Object& exp)
+{
+	if (exp.get_type() != CONS || cdr(exp).get_type() != NIL)
+		error_handler("ERROR(scheme): ill-formed special form -- quote");
+
+	return car(exp);
+}
+
+/* Expand a quasiquote template, depth is the nesting level of quasiquote */
+static Object quasi_expand(const Object& tmpl, int depth)
+{
+	if (tmpl.get_type() != CONS)
+		return tmpl;
+
+	/* ,exp or nested `exp */
+	if (is_tagged(tmpl, "unquote") || is_tagged(tmpl, "quasiquote")) {
+		int new_depth = depth + (is_tagged(tmpl, "unquote") ? -1 : 1);
+		if (new_depth == 0)
+			return eval(cadr(tmpl));
+		return Object(Cons(car(tmpl), quasi_expand(cdr(tmpl), new_depth)));
+	}
+
+	/* ,@exp, splice the value of exp into the list. The head is expanded
+	 * before the rest, so unquoted expressions are evaluated left to right.
+	 */
+	const Object& first = car(tmpl);
+	if (depth == 1 && is_tagged(first, "unquote-splicing")) {
+		Object spliced = eval(cadr(first));
+		if (!is_true(Primitive::is_list(vector<Object>{ spliced })))
+			error_handler("ERROR(scheme): ,@ requires a list -- quasiquote");
+		Object rest = quasi_expand(cdr(tmpl), depth);
+		if (spliced.get_type() == NIL)
+			return rest;
+		return Primitive::append(vector<Object>{ spliced, rest });
+	}
+	Object head = quasi_expand(first, depth);
+	return Object(Cons(head, quasi_expand(cdr(tmpl), depth)));
+}
+
+/* Handler with "quasiquote" expression, for example:
+ * "`(1 ,(+ 1 1) ,@(list 3 4))" --> the list (1 2 3 4).
+ */
+Object eval_quasiquote(const Object& exp)
+{
+	if (exp.get_type() != CONS || cdr(exp).get_type() != NIL)
+		error_handler("ERROR(scheme): ill-formed special form -- quasiquote");
+
+	return quasi_expand(car(exp), 1);
+}
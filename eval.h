@@ -7,21 +7,178 @@
 #include <unordered_map>
 #include <algorithm>
 #include <cassert>
+#include <atomic>
+#include <mutex>
 using namespace std;
 
 #include "object.h"
 #include "io_function.h"
 #include "primitive_procedures.h"
+#include "port.h"
+#include "profiler.h"
+#include "runtime_stats.h"
+#include "macro.h"
 
-/* Keywords of Scheme */
-static vector<string> keywords{
-	"define", "if", "set!", "lambda", "begin", "let", "cond"
+/* Special forms of Scheme, a symbol naming a special form(keyword) keeps
+ * its index when it's constructed, see Object::get_special_form().
+ */
+enum SpecialForm {
+	NOT_SPECIAL = -1, SF_DEFINE, SF_IF, SF_SET, SF_LAMBDA, SF_BEGIN,
+	SF_QUOTE, SF_QUASIQUOTE, SF_AND, SF_OR, SF_WHEN, SF_UNLESS,
+	SF_CASE_LAMBDA, SF_LOOP, SF_LOOP_NEXT
 };
 
+/* Return the special form named name, NOT_SPECIAL if name isn't a keyword */
+int special_form(const string& name);
+
 using SubEnv = unordered_map<string, Object>;
-using Environment = vector<SubEnv>;
 
-/* Reset the global environment. */
+/* Frame: variables bound by a procedure call, a loop, or the global
+ * environment. A frame is linked to the frame where its procedure was
+ * created(parent), so variables are looked up lexically; closures share
+ * the frame where they are created instead of copying it.
+ */
+struct Frame {
+	SubEnv				vars;
+	shared_ptr<Frame>	parent;		/* Null: the global environment */
+};
+
+/* Frames being evaluated, envs[0] is the global environment */
+using Environment = vector<shared_ptr<Frame>>;
+
+/* A named let being evaluated as a loop, see eval_loop() */
+struct LoopFrame {
+	int				id;			/* Id of the loop given by expand() */
+	size_t			env;		/* Index of the frame of loop variables */
+	const Object*	tag;		/* Name of the loop */
+	const Object*	vars;		/* List of loop variables */
+	vector<Object>	next;		/* Values of the next iteration */
+};
+
+/* Interpreter: state of an evaluator, includes environments and ports.
+ * Interpreters are independent of each other, so different threads can
+ * run different interpreters at the same time, but an interpreter can be
+ * used by only one thread at a time.
+ */
+class Interpreter {
+public:
+	/* Constructor, initialize the global environment */
+	Interpreter();
+
+	/* Copy, used by the workers of parallel-map and threads; the global
+	 * environment is copied, frames of closures are shared.
+	 */
+	Interpreter(const Interpreter& other);
+	Interpreter& operator=(const Interpreter&) = delete;
+	~Interpreter();
+
+	/* Reset the global environment */
+	void reset();
+
+	/* Embedding interface, see scheme.h. */
+	/* Evaluate all expressions of code, return the value of the last one */
+	Object eval_string(const string& code);
+	/* Call proc with args, proc is a procedure object or a name */
+	Object call(const Object& proc, const vector<Object>& args);
+	Object call(const string& name, const vector<Object>& args);
+	/* Define or update a variable in the global environment */
+	void define(const string& name, const Object& value);
+	/* Define a primitive procedure, func may be a lambda with captures */
+	void define_procedure(const string& name, Procedure::PrimitiveFunc func);
+	/* Return the value of a variable */
+	Object lookup(const string& name);
+
+	/* envs[0]: global environment, envs[n]: frames of procedures being
+	 * called, see eval.cpp.
+	 */
+	Environment				envs;
+
+	/* Frames popped while closures kept them, the closures may be dropped
+	 * later, so they are checked again when there are collect_limit of them,
+	 * see collect_frames().
+	 */
+	vector<weak_ptr<Frame>>	kept_frames;
+	size_t					collect_limit;
+
+	/* Depth of nested "load", used to print loading information */
+	int						load_depth;
+
+	/* A keyword is bound as a variable, such as (lambda (if) (if 1)), so
+	 * special forms are looked up in envs before they are evaluated.
+	 */
+	bool					keywords_shadowed;
+
+	/* Named lets being evaluated, loop_jump is the id of the loop whose
+	 * next iteration has been requested, -1 if none.
+	 */
+	vector<LoopFrame>		loops;
+	int						loop_jump;
+
+	/* Macros of define-syntax and derived forms, such as let and cond */
+	MacroTable				macros;
+
+	/* Default ports of display, read-line and so on */
+	shared_ptr<InputPort>	input_port;
+	shared_ptr<OutputPort>	output_port;
+
+	/* Profiler started by profile-start, procedures being called are kept
+	 * in call_stack while it's not null.
+	 */
+	shared_ptr<Profiler>	profiler;
+	CallStack				call_stack;
+
+	/* Statistics started by runtime-stats-start, null if not started */
+	shared_ptr<RuntimeStats>	stats;
+};
+
+/* Make interp the interpreter of current thread, functions without an 
+ * Interpreter argument evaluate in it. The previous one is restored when
+ * the InterpreterScope is destroyed.
+ */
+class InterpreterScope {
+public:
+	explicit InterpreterScope(Interpreter& interp);
+	InterpreterScope(const InterpreterScope&) = delete;
+	InterpreterScope& operator=(const InterpreterScope&) = delete;
+	~InterpreterScope();
+private:
+	Interpreter* saved;	/* Interpreter of current thread before */
+};
+
+/* Number of threads evaluating in copies of interpreters(spawned threads
+ * and workers of parallel-map). Procedures and the frames where they were
+ * created are shared by threads, so frames are locked when they are
+ * accessed while it isn't 0.
+ */
+extern atomic<int> running_threads;
+
+/* Evaluator state of a worker thread: while a WorkerState is alive, the
+ * current thread evaluates in a copy of parent, and it's counted in
+ * running_threads.
+ */
+class WorkerState {
+public:
+	explicit WorkerState(const Interpreter& parent);
+	~WorkerState();
+private:
+	Interpreter		worker;
+	InterpreterScope	scope;
+};
+
+/* Return the interpreter of current thread */
+Interpreter& current_interpreter();
+
+/* Remove the frames of envs above depth, such as frames of procedures which
+ * haven't returned because of errors or continuations.
+ */
+void remove_frames(Interpreter& interp, size_t depth);
+
+/* Add the pairs allocated by current thread to the statistics of current
+ * interpreter, called before statistics are read.
+ */
+void update_cons_count();
+
+/* Reset the global environment of current interpreter. */
 void initialize_environment();
 
 /* Reset evaluator, reset environment */
@@ -31,43 +188,83 @@ void reset_evaluator();
 /* mode == 0: print prompt and value, such as ">>> Eval value: a";
  * mode == 1: don't print prompt and value, used to evaluate code from file.
  * mode == 2: don't print prompt, but print value.
+ * Return the value of the last expression.
  */
-void run_evaluator(istream &in, int mode = 0);
+Object run_evaluator(Interpreter& interp, istream &in, int mode = 0);
+
+/* Evaluator start, in current interpreter. */
+Object run_evaluator(istream &in, int mode = 0);
+
+/* Evaluating a expression in interp. */
+Object eval(Interpreter& interp, const Object& exp);
+
+/* Evaluating expressions read from split, return the last value. */
+Object eval(const vector<string>& split);
 
-/* Evaluating a expression. */
-Object eval(vector<string>& split);
+/* Evaluating a expression, exp is a datum built by read_datum(). */
+Object eval(const Object& exp);
 
-/* Evaluating a single string. */
-Object eval(string& str);
+/* Evaluating a variable. */
+Object eval_variable(const string& str);
+
+/* Evaluating a free identifier of a macro template, a KEYWORD object, in
+ * the global environment, see Macro::instantiate().
+ */
+Object eval_global(const Object& exp);
 
 /* Call proc with obs. */
-Object apply_proc(Object &op, vector<Object>& obs);
+Object apply_proc(const Object &op, const vector<Object>& obs);
 
-/* Handle with keyword */
-Object eval_keyword(const string& keyword, vector<string>& exp);
+/* Handle with keyword, form is a SpecialForm, exp is the list of operands
+ * of the special form.
+ */
+Object eval_keyword(int form, const Object& exp);
 
 /* Handle with "define" expression */
-Object eval_define(vector<string>& args);
+Object eval_define(const Object& exp);
 
-/* Handle with "define" expression */
-Object eval_lambda(vector<string>& exp, const string& proc_name = "*anonymous*");
+/* Handle with "lambda" expression */
+Object eval_lambda(const Object& exp, const string& proc_name = "*anonymous*");
+
+/* Handle with "case-lambda" expression, such as
+ * "(case-lambda ((x) x) ((x y . z) y))", a call is evaluated by the first
+ * clause which accepts the number of arguments.
+ */
+Object eval_case_lambda(const Object& exp);
 
 /* Return true if object is some kinds of "true" */
-bool is_true(Object& ob);
+bool is_true(const Object& ob);
 
 /* Handler with "if" expression */
-Object eval_if(vector<string>& exp);
+Object eval_if(const Object& exp);
 
 /* Handler with "begin" expression */
-Object eval_begin(vector<string>& exp);
+Object eval_begin(const Object& exp);
 
-/* Handler with "begin" expression */
-Object eval_let(vector<string>& exp);
+/* Handler with "and" and "or" expressions, operands are evaluated until
+ * the result is decided.
+ */
+Object eval_and(const Object& exp);
+Object eval_or(const Object& exp);
+
+/* Handler with "when" and "unless" expressions */
+Object eval_when(const Object& exp, bool condition);
 
-/* Handler with "cond" expression */
-Object eval_cond(vector<string>& exp);
+/* Handler with named let compiled by expand():
+ * "(%loop id tag (var ...) (init ...) body ...)" evaluates body in one frame
+ * of vars until it returns without "(%loop-next id arg ...)", which assigns
+ * args to vars in place and jumps back to the start of the body.
+ */
+Object eval_loop(const Object& exp);
+Object eval_loop_next(const Object& exp);
 
 /* Handler with "set" expression */
-Object eval_set(vector<string>& exp);
+Object eval_set(const Object& exp);
+
+/* Handler with "quote" expression */
+Object eval_quote(const Object& exp);
+
+/* Handler with "quasiquote" expression */
+Object eval_quasiquote(const Object& exp);
 
 #endif
\ No newline at end of file
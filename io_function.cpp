@@ -1,17 +1,24 @@
 /* Input and Output function */
 
+#include <cstring>
+#include <cstdlib>
+#include <charconv>
 #include "io_function.h"
 #include "primitive_procedures.h"
 #include "eval.h"
+#include "port.h"
 
 /* Print evaluation result. */
 void print_result(const Object& ob, int mode)
 {
+	OutputPort& port = *current_interpreter().output_port;
+	lock_guard<mutex> guard(port.get_lock());	/* Shared with threads */
 	if (mode == 0)
-		cout << ">>> Eval value: ";
+		port.put(">>> Eval value: ");
 	if (mode == 0 || mode == 2) {
-		Primitive::display(vector<Object>{ob});
-		cout << endl;
+		port.print(ob, true);
+		port.put('\n');
+		port.flush();
 	}
 }
 
@@ -25,7 +32,7 @@ string get_input(istream &in)
 	char ctmp;
 	int in_quotes = 0;
 	while (in.get(ctmp)) {
-		if (ctmp == ';') {/* Ignore comment line. */
+		if (in_quotes == 0 && ctmp == ';') {/* Ignore comment line. */
 			getline(in, stmp); 
 			continue;
 		}
@@ -43,9 +50,19 @@ string get_input(istream &in)
 			continue;
 		}
 
+		/* Keep escaped character in quotes, such as "a\"b" */
+		if (in_quotes == 1 && ctmp == '\\') {
+			result.push_back(ctmp);
+			if (in.get(ctmp))
+				result.push_back(ctmp);
+			continue;
+		}
+
 		if (ctmp != '\n') {
-			/* Add a space at both sides of parentheses. */
-			if (ctmp == '(' || ctmp == ')') {
+			/* Add a space at both sides of parentheses, except those in
+			 * strings, such as "f(x)".
+			 */
+			if (in_quotes == 0 && (ctmp == '(' || ctmp == ')')) {
 				result.push_back(' ');
 				result.push_back(ctmp);
 				result.push_back(' ');
@@ -54,8 +71,8 @@ string get_input(istream &in)
 				result.push_back(ctmp);
 		}
 
-		if (ctmp == '(') cntParantheses++;
-		else if (ctmp == ')') cntParantheses--;
+		if (in_quotes == 0 && ctmp == '(') cntParantheses++;
+		else if (in_quotes == 0 && ctmp == ')') cntParantheses--;
 		else if (ctmp == '"') {
 			cntQuotations++;
 			in_quotes = cntQuotations % 2;
@@ -73,65 +90,253 @@ string get_input(istream &in)
 				result.push_back(' ');
 		}
 	}
-#ifndef NDEBUG
+#ifdef SCHEME_DEBUG
 	cout << "DEBUG get_input(): " << result << endl;
 #endif
 	return result;
 }
 
-/* Convert '(<exp1> ... <expn>) too (list <exp1> ... <expn>) */
-static void convert_to_list(vector<string>& split)
-{
-	for (int i = 0; i < split.size(); i++) {
-		if (split[i] == "'") {
-			split[i] = "list";
-			swap(split[i], split[i + 1]);
-		}
-	}
-}
+/* Abbreviations of quotations, such as 'a --> (quote a) */
+static const vector<pair<string, string>> quotations{
+	make_pair("'", "quote"), make_pair("`", "quasiquote"),
+	make_pair(",@", "unquote-splicing"), make_pair(",", "unquote")
+};
 
 /* Split input string and store them in a vector<string>. */
-vector<string> split_input(string& input)
+vector<string> split_input(const string& input)
 {
 	vector<string> split;
 	string tmp;
 	for (int i = 0; i < input.size(); ++i) {
 		if (input[i] == ' ' || input[i] == '\t') continue;
 
+		/* Split the abbreviation of quotation, "'(1 2)" --> "'", "(1 2)" */
+		if (input[i] == '\'' || input[i] == '`' || input[i] == ',') {
+			if (input[i] == ',' && i + 1 < input.size() && input[i + 1] == '@')
+				split.push_back(input.substr(i++, 2));
+			else
+				split.push_back(input.substr(i, 1));
+			continue;
+		}
+
 		int start = i;
 		/* Don't split "string", such as "abc def ghi". */
 		char mark = (input[i] == '"' ? '"' : ' ');
 
-		while (++i < input.size() && input[i] != mark);
+		while (++i < input.size() && input[i] != mark)
+			if (mark == '"' && input[i] == '\\')
+				i++;	/* Skip escaped character, such as "a\"b" */
 		if (mark == '"') i++;
 		split.push_back(input.substr(start, i - start));
 	}
-#ifndef NDEBUG
+#ifdef SCHEME_DEBUG
 	cout << "DEBUG split_input(): ";
 	for (auto s : split)
 		cout << s << ", ";
 	cout << endl;
 #endif
-	convert_to_list(split);
 	return split;
 }
 
-/* Handler error */
+/* Names of special characters, such as #\\space */
+static const vector<pair<string, char>> char_names{
+	make_pair("space", ' '), make_pair("newline", '\n'),
+	make_pair("tab", '\t'), make_pair("nul", '\0')
+};
+
+/* Return the external representation of a character, 'a' --> "#\\a" */
+string char_name(char c)
+{
+	for (auto &name : char_names)
+		if (name.second == c)
+			return "#\\" + name.first;
+	return string("#\\") + c;
+}
+
+/* Return the characters of a string token, escape sequences are converted,
+ * such as "a\"b\n" --> a"b<newline>.
+ */
+static string read_string(const string& token)
+{
+	string chars;
+	size_t end = token.size() - 1;	/* Skip the quotations of both ends */
+	chars.reserve(end);
+	for (size_t i = 1; i < end; i++) {
+		char c = token[i];
+		if (c == '\\' && i + 1 < end) {
+			c = token[++i];
+			if (c == 'n') c = '\n';
+			else if (c == 't') c = '\t';
+		}
+		chars.push_back(c);
+	}
+	return chars;
+}
+
+/* Numbers are converted by from_chars and to_chars, which don't depend on
+ * the locale or throw exceptions.
+ */
+bool read_number(const char* first, const char* last, Object& number)
+{
+	/* A sign must be followed by digits or '.', from_chars also reads
+	 * "inf" and "nan".
+	 */
+	const char* digits = first;
+	if (digits != last && (*digits == '+' || *digits == '-'))
+		digits++;
+	if (digits == last || !(isdigit(static_cast<unsigned char>(*digits)) ||
+		*digits == '.'))
+		return false;
+	if (*first == '+')	/* from_chars doesn't take '+' */
+		first++;
+	if (find_if(first, last, [](char c) {
+		return c == '.' || c == 'e' || c == 'E'; }) == last) {
+		int integer;
+		auto result = from_chars(first, last, integer);
+		if (result.ec == errc() && result.ptr == last) {
+			number = Object(integer);
+			return true;
+		}
+		/* A real would lose the digits of a large integer */
+		if (result.ec == errc::result_out_of_range &&
+			all_of(first, last, [](char c) {
+				return isdigit(static_cast<unsigned char>(c)) || c == '-'; }))
+			error_handler("ERROR(scheme): integer out of range -- " +
+				string(first, last));
+		return false;
+	}
+	double real;
+	auto result = from_chars(first, last, real);
+	if (result.ptr != last ||
+		(result.ec != errc() && result.ec != errc::result_out_of_range))
+		return false;
+	/* real isn't set when it's out of range, strtod gives inf or 0 */
+	if (result.ec == errc::result_out_of_range)
+		real = strtod(string(first, last).c_str(), nullptr);
+	number = Object(real);
+	return true;
+}
+
+char* write_number(char* buf, const Object& ob)
+{
+	if (ob.get_type() == INTEGER)
+		return to_chars(buf, buf + NUMBER_CHARS_MAX, ob.get_integer()).ptr;
+	/* An integral real keeps its type when it's read back, 2.0 --> "2.0" */
+	char* end = to_chars(buf, buf + NUMBER_CHARS_MAX - 2, ob.get_real()).ptr;
+	if (find_if(buf, end, [](char c) {
+		return c == '.' || c == 'e' || c == 'n'; }) == end) {	/* inf, nan */
+		*end++ = '.';
+		*end++ = '0';
+	}
+	return end;
+}
+
+/* Return true if token str is written as a number, such as "-1", "+.5" */
+static bool is_number_token(const string& str)
+{
+	size_t i = (str[0] == '-' || str[0] == '+') ? 1 : 0;
+	if (i < str.size() && str[i] == '.')
+		i++;
+	return i < str.size() && isdigit(static_cast<unsigned char>(str[i]));
+}
+
+/* Convert a single token to an object: number, string, boolean or symbol */
+static Object read_atom(const string& str)
+{
+	/* NUMBER or REAL, a token which isn't a whole number, such as "1+",
+	 * is a symbol.
+	 */
+	Object number;
+	if (is_number_token(str) &&
+		read_number(str.data(), str.data() + str.size(), number))
+		return number;
+	/* STRING */
+	else if (str[0] == '"')
+		return Object(read_string(str));
+	/* BOOLEAN */
+	else if (str == "#t" || str == "#true")
+		return Object(true);
+	else if (str == "#f" || str == "#false")
+		return Object(false);
+	/* CHAR, such as #\\a, #\\space */
+	else if (str.size() > 2 && str[0] == '#' && str[1] == '\\') {
+		if (str.size() == 3)
+			return Object(str.substr(2), CHAR);
+		for (auto &name : char_names)
+			if (str.substr(2) == name.first)
+				return Object(string(1, name.second), CHAR);
+		error_handler("ERROR(scheme): unknown character -- " + str);
+	}
+	/* SYMBOL */
+	else
+		return Object(str, SYMBOL);
+}
+
+/* Read a datum from split, starting at split[pos], pos is moved past it. */
+Object read_datum(const vector<string>& split, size_t& pos)
+{
+	if (pos >= split.size())
+		error_handler("ERROR(scheme): unexpected end of input -- read");
+
+	const string& token = split[pos++];
+	/* List, such as "(1 2 3)" or "(1 . 2)" */
+	if (token == "(") {
+		vector<Object> elements;
+		Object tail("nil", NIL);
+		while (pos < split.size() && split[pos] != ")") {
+			if (split[pos] == "." && !elements.empty()) {
+				tail = read_datum(split, ++pos);
+				break;
+			}
+			elements.push_back(read_datum(split, pos));
+		}
+		if (pos >= split.size() || split[pos] != ")")
+			error_handler("ERROR(scheme): missing \")\" -- read");
+		pos++;
+
+		for (int i = elements.size() - 1; i >= 0; i--)
+			tail = Object(Cons(elements[i], tail));
+		return tail;
+	}
+	else if (token == ")")
+		error_handler("ERROR(scheme): unexpected \")\" -- read");
+
+	/* Quotation, "'a" --> "(quote a)" */
+	for (auto &q : quotations) {
+		if (token == q.first) {
+			Object quoted = read_datum(split, pos);
+			return Object(Cons(Object(q.second, SYMBOL),
+				Object(Cons(quoted, Object("nil", NIL)))));
+		}
+	}
+	return read_atom(token);
+}
+
+/* Handler error: stop evaluating, the error is reported by the one who
+ * catches it, see run_evaluator().
+ */
 void error_handler(const string& msg)
 {
+	if (tracing())
+		trace_record(TRACE_ERROR, msg);
+	throw SchemeError(msg);
+}
+
+/* Report error, and ask user whether to continue */
+void report_error(const string& msg)
+{
+	standard_output_port().flush();
 	cerr << msg << endl;
 	cout << "Input [Enter] or [Y/y] to continue and input others to quit: ";
-	char input = getchar();
+	int input = getchar(), extra = input;
 	/* Delete extra characters */
-	if (input != '\n')
-		while (getchar() != '\n') continue;
+	while (extra != '\n' && extra != EOF)
+		extra = getchar();
 	if (input == '\n' || input == 'y' || input == 'Y')
-		run_evaluator(cin);
-	else {
-		cout << "Bye! Press any key to quit." << endl;
-		input = getchar();
-		exit(0);
-	}
+		return;
+	cout << "Bye! Press any key to quit." << endl;
+	input = getchar();
+	exit(0);
 }
 
 /* Evaluate expression from a string */
@@ -145,6 +350,13 @@ void load_code(const string& code)
 	Object result = eval(split);
 }
 
+/* Evaluate expression from a string in interp */
+void load_code(Interpreter& interp, const string& code)
+{
+	InterpreterScope scope(interp);
+	load_code(code);
+}
+
 /* Evaluatoe code from file */
 void load_file(const string& filename)
 {
@@ -155,3 +367,79 @@ void load_file(const string& filename)
 	vector<string> split = split_input(input);
 	eval(split);
 }
+
+/* Evaluatoe code from file in interp */
+void load_file(Interpreter& interp, const string& filename)
+{
+	InterpreterScope scope(interp);
+	load_file(filename);
+}
+
+
+/* Call proc with a line, print the result */
+static void map_line(const char* line, size_t n, const Object& proc,
+	vector<Object>& args, OutputPort& port)
+{
+	if (n > 0 && line[n - 1] == '\r')	/* "\r\n" */
+		n--;
+	args[0] = Object(string(line, n));
+	Object result = apply_proc(proc, args);
+
+	int type = result.get_type();
+	if (type == UNASSIGNED || (type == BOOLEAN && !result.get_boolean()))
+		return;
+	port.print(result);
+	port.put('\n');
+}
+
+/* Call proc with each line of in as a string, print the results. */
+/* Input is read in large chunks and lines are found in the chunk in place.
+ * Each line is copied once into the string passed to proc, because proc may
+ * keep the string after the chunk is reused; a line across two chunks is
+ * joined first.
+ */
+void map_lines(istream& in, const Object& proc)
+{
+	if (proc.get_type() != PROCEDURE)
+		error_handler("ERROR(scheme): the file of --map-lines must return "
+			"a procedure, such as (lambda (line) line)");
+
+	static const size_t CHUNK_SIZE = 1 << 20;
+	vector<char> chunk(CHUNK_SIZE);
+	string rest;			/* Rest of a line in the previous chunk */
+	vector<Object> args(1);
+	OutputPort& port = *current_interpreter().output_port;
+
+	while (in) {
+		in.read(chunk.data(), CHUNK_SIZE);
+		const char* begin = chunk.data();
+		const char* end = begin + in.gcount();
+		while (begin != end) {
+			const char* newline = static_cast<const char*>(
+				memchr(begin, '\n', end - begin));
+			if (newline == nullptr) {
+				rest.append(begin, end);
+				break;
+			}
+			if (rest.empty())
+				map_line(begin, newline - begin, proc, args, port);
+			else {
+				rest.append(begin, newline);
+				map_line(rest.data(), rest.size(), proc, args, port);
+				rest.clear();
+			}
+			begin = newline + 1;
+		}
+	}
+	/* The last line without '\n' */
+	if (!rest.empty())
+		map_line(rest.data(), rest.size(), proc, args, port);
+	port.flush();
+}
+
+/* Call proc with each line of in as a string in interp, print the results */
+void map_lines(Interpreter& interp, istream& in, const Object& proc)
+{
+	InterpreterScope scope(interp);
+	map_lines(in, proc);
+}
\ No newline at end of file
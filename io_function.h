@@ -7,10 +7,13 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <stdexcept>
 
 using namespace std;
 #include "object.h"
 
+class Interpreter;
+
 /* Print evaluation result. */
 void print_result(const Object& ob, int mode = 0);
 
@@ -18,15 +21,59 @@ void print_result(const Object& ob, int mode = 0);
 string get_input(istream &in);
 
 /* Split input string and store them in a vector<string>. */
-vector<string> split_input(string& input);
+vector<string> split_input(const string& input);
+
+/* Read a datum from split, starting at split[pos], pos is moved past it. */
+/* "'(1 (2 3))" --> a list of 1 and (2 3), "'a" --> (quote a) */
+Object read_datum(const vector<string>& split, size_t& pos);
+
+/* Convert chars [first, last) to a number, return false if they aren't a
+ * number, such as "12", "-1.5", "+3", ".5" and "1e3". Integers are exact,
+ * an integer out of the range of int is an error.
+ */
+bool read_number(const char* first, const char* last, Object& number);
+
+/* Write number ob to buf with the shortest form which is read back as the
+ * same number, such as 0.1 --> "0.1" and 2.0 --> "2.0"; return the end of
+ * the characters.
+ * buf must have NUMBER_CHARS_MAX bytes.
+ */
+const size_t NUMBER_CHARS_MAX = 32;
+char* write_number(char* buf, const Object& ob);
+
+/* Return the external representation of a character, 'a' --> "#\\a" */
+string char_name(char c);
+
+/* Error of Scheme, such as "ERROR(scheme): unknown symbol -- a" */
+class SchemeError : public runtime_error {
+public:
+	explicit SchemeError(const string& msg) : runtime_error(msg) {}
+};
 
-/* Handler error */
-void error_handler(const string& msg);
+/* Handler error, throw a SchemeError */
+[[noreturn]] void error_handler(const string& msg);
 
-/* Evaluate expression from a string */
+/* Report error, and ask user whether to continue, quit if user refuses */
+void report_error(const string& msg);
+
+/* Call proc with each line of in as a string, print the results: 
+ * a string is printed as a line, #f and unspecified value are skipped.
+ */
+void map_lines(istream& in, const Object& proc);
+
+/* Call proc with each line of in as a string in interp, print the results */
+void map_lines(Interpreter& interp, istream& in, const Object& proc);
+
+/* Evaluate expression from a string, in current interpreter */
 void load_code(const string& code);
 
-/* Evaluatoe code from file */
+/* Evaluate expression from a string in interp */
+void load_code(Interpreter& interp, const string& code);
+
+/* Evaluatoe code from file, in current interpreter */
 void load_file(const string& filename);
 
+/* Evaluatoe code from file in interp */
+void load_file(Interpreter& interp, const string& filename);
+
 #endif
\ No newline at end of file
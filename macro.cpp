@@ -0,0 +1,800 @@
+/* Implement of macros */
+
+#include <algorithm>
+#include <atomic>
+#include <sstream>
+#include "macro.h"
+#include "eval.h"
+#include "io_function.h"
+
+/* Helpers to walk data */
+static inline const Object& car(const Object& ob) { return ob.get_cons()->car(); }
+static inline const Object& cdr(const Object& ob) { return ob.get_cons()->cdr(); }
+static inline Object make_nil() { return Object("nil", NIL); }
+
+static inline bool is_symbol(const Object& ob, const string& name)
+{
+	return ob.get_type() == SYMBOL && ob.get_string() == name;
+}
+
+/* Return true if ob is the symbol name, or the free identifier name of a
+ * template, such as "lambda" in the expansion of let.
+ */
+static inline bool is_identifier(const Object& ob, const string& name)
+{
+	return (ob.get_type() == SYMBOL || ob.get_type() == KEYWORD) &&
+		ob.get_string() == name;
+}
+
+/* Return the number of pairs of list, (1 2 . 3) has 2 */
+static size_t count_pairs(const Object& list)
+{
+	size_t n = 0;
+	for (const Object* rest = &list; rest->get_type() == CONS; rest = &cdr(*rest))
+		n++;
+	return n;
+}
+
+/* Counter of renamed variables, shared by all interpreters */
+static atomic<unsigned> rename_count(0);
+
+/* Counter of ids of loops compiled from named let */
+static atomic<int> loop_count(0);
+
+Macro::Macro(const string& macro_name, const Object& spec,
+	const vector<string>& scope) :
+	name(macro_name), ellipsis("..."), scope_locals(scope.begin(), scope.end())
+{
+	if (spec.get_type() != CONS || !is_identifier(car(spec), "syntax-rules") ||
+		cdr(spec).get_type() != CONS)
+		error_handler("ERROR(scheme): syntax-rules required -- " + name);
+	Object rest = cdr(spec);
+	/* Custom ellipsis, (syntax-rules ::: (literal ...) rules) */
+	if (car(rest).get_type() == SYMBOL) {
+		ellipsis = car(rest).get_string();
+		rest = cdr(rest);
+		if (rest.get_type() != CONS)
+			error_handler("ERROR(scheme): ill-formed syntax-rules -- " + name);
+	}
+	for (Object lit = car(rest); lit.get_type() == CONS; lit = cdr(lit)) {
+		if (car(lit).get_type() != SYMBOL)
+			error_handler("ERROR(scheme): literal must be a symbol -- " + name);
+		literals.push_back(car(lit).get_string());
+	}
+
+	for (rest = cdr(rest); rest.get_type() == CONS; rest = cdr(rest)) {
+		const Object& one_rule = car(rest);
+		if (one_rule.get_type() != CONS || car(one_rule).get_type() != CONS ||
+			cdr(one_rule).get_type() != CONS)
+			error_handler("ERROR(scheme): rule must be (pattern template) -- " +
+				name);
+		Rule rule;
+		rule.pattern = car(one_rule);
+		rule.tmpl = car(cdr(one_rule));
+		/* The keyword of pattern is ignored */
+		pattern_variables(cdr(rule.pattern), rule.variables);
+		template_binders(rule.tmpl, rule, rule.binders);
+		if (!scope_locals.empty())
+			template_locals(rule.tmpl, rule, rule.locals);
+		rules.push_back(std::move(rule));
+	}
+}
+
+bool Macro::is_ellipsis(const Object& ob) const
+{
+	return is_symbol(ob, ellipsis);
+}
+
+bool Macro::is_literal(const string& symbol) const
+{
+	return find(literals.begin(), literals.end(), symbol) != literals.end();
+}
+
+void Macro::pattern_variables(const Object& pattern,
+	unordered_set<string>& variables) const
+{
+	if (pattern.get_type() == SYMBOL) {
+		const string& symbol = pattern.get_string();
+		if (symbol != "_" && symbol != ellipsis && !is_literal(symbol))
+			variables.insert(symbol);
+	}
+	else if (pattern.get_type() == CONS) {
+		pattern_variables(car(pattern), variables);
+		pattern_variables(cdr(pattern), variables);
+	}
+}
+
+void Macro::template_binders(const Object& tmpl, const Rule& rule,
+	unordered_set<string>& binders) const
+{
+	if (tmpl.get_type() != CONS)
+		return;
+	auto add = [&](const Object& var) {
+		if (var.get_type() == SYMBOL && !is_ellipsis(var) &&
+			rule.variables.count(var.get_string()) == 0)
+			binders.insert(var.get_string());
+	};
+
+	const Object& head = car(tmpl);
+	if (head.get_type() == SYMBOL && cdr(tmpl).get_type() == CONS) {
+		const string& form = head.get_string();
+		Object second = car(cdr(tmpl));
+		/* (lambda (x y . z) ...) */
+		if (form == "lambda") {
+			for (; second.get_type() == CONS; second = cdr(second))
+				add(car(second));
+			add(second);
+		}
+		/* (case-lambda ((x) ...) ((x . y) ...)) */
+		else if (form == "case-lambda") {
+			for (Object rest = cdr(tmpl); rest.get_type() == CONS; rest = cdr(rest)) {
+				if (car(rest).get_type() != CONS)
+					continue;
+				Object params = car(car(rest));
+				for (; params.get_type() == CONS; params = cdr(params))
+					add(car(params));
+				add(params);
+			}
+		}
+		/* (define x ...), (define (f x) ...) */
+		else if (form == "define") {
+			if (second.get_type() == CONS) {
+				add(car(second));
+				for (second = cdr(second); second.get_type() == CONS; second = cdr(second))
+					add(car(second));
+			}
+			add(second);
+		}
+		/* (let ((x 1) ...) ...), (let loop ((x 1) ...) ...), (do ((x 1) ...) ...) */
+		else if (form == "let" || form == "let*" || form == "letrec" ||
+			form == "letrec*" || form == "do") {
+			if (second.get_type() == SYMBOL && form == "let") {
+				add(second);
+				second = cdr(cdr(tmpl)).get_type() == CONS ?
+					car(cdr(cdr(tmpl))) : make_nil();
+			}
+			for (; second.get_type() == CONS; second = cdr(second))
+				if (car(second).get_type() == CONS)
+					add(car(car(second)));
+		}
+	}
+	for (const Object* rest = &tmpl; rest->get_type() == CONS; rest = &cdr(*rest))
+		template_binders(car(*rest), rule, binders);
+}
+
+void Macro::template_locals(const Object& tmpl, const Rule& rule,
+	unordered_set<string>& locals) const
+{
+	if (tmpl.get_type() == SYMBOL) {
+		const string& symbol = tmpl.get_string();
+		if (scope_locals.count(symbol) != 0 && rule.variables.count(symbol) == 0 &&
+			rule.binders.count(symbol) == 0)
+			locals.insert(symbol);
+	}
+	else if (tmpl.get_type() == CONS) {
+		if (is_symbol(car(tmpl), "quote") || is_symbol(car(tmpl), "syntax-rules"))
+			return;
+		template_locals(car(tmpl), rule, locals);
+		template_locals(cdr(tmpl), rule, locals);
+	}
+}
+
+bool Macro::match(const Object& pattern, const Object& form,
+	const Rule& rule, Bindings& bindings) const
+{
+	switch (pattern.get_type()) {
+	case SYMBOL: {
+		const string& symbol = pattern.get_string();
+		if (symbol == "_")
+			return true;
+		if (is_literal(symbol))
+			return is_identifier(form, symbol);
+		bindings[symbol].form = form;
+		return true;
+	}
+	case CONS:
+		break;
+	case NIL:
+		return form.get_type() == NIL;
+	default:
+		return pattern == form;
+	}
+
+	/* (p ... . rest): p matches as many elements as rest allows */
+	const Object& next = cdr(pattern);
+	if (next.get_type() == CONS && is_ellipsis(car(next))) {
+		const Object& rest = cdr(next);
+		size_t min_rest = count_pairs(rest);
+		size_t n = count_pairs(form);
+		if (n < min_rest)
+			return false;
+		unordered_set<string> variables;
+		pattern_variables(car(pattern), variables);
+		for (auto &var : variables)
+			bindings[var] = Binding{ Object(), {}, true };
+
+		const Object* item = &form;
+		for (size_t i = 0; i < n - min_rest; i++, item = &cdr(*item)) {
+			Bindings item_bindings;
+			if (!match(car(pattern), car(*item), rule, item_bindings))
+				return false;
+			for (auto &var : variables)
+				bindings[var].items.push_back(std::move(item_bindings[var]));
+		}
+		return match(rest, *item, rule, bindings);
+	}
+
+	if (form.get_type() != CONS)
+		return false;
+	return match(car(pattern), car(form), rule, bindings) &&
+		match(cdr(pattern), cdr(form), rule, bindings);
+}
+
+/* Add the variables of tmpl bound to sequences to variables */
+static void sequence_variables(const Object& tmpl,
+	const unordered_map<string, bool>& is_sequence, vector<string>& variables)
+{
+	if (tmpl.get_type() == SYMBOL) {
+		auto it = is_sequence.find(tmpl.get_string());
+		if (it != is_sequence.end() && it->second &&
+			find(variables.begin(), variables.end(), it->first) == variables.end())
+			variables.push_back(it->first);
+	}
+	else if (tmpl.get_type() == CONS) {
+		sequence_variables(car(tmpl), is_sequence, variables);
+		sequence_variables(cdr(tmpl), is_sequence, variables);
+	}
+}
+
+Object Macro::instantiate(const Object& tmpl, const Rule& rule,
+	const Bindings& bindings, Renames& renames, bool data) const
+{
+	if (tmpl.get_type() == SYMBOL) {
+		const string& symbol = tmpl.get_string();
+		auto found = bindings.find(symbol);
+		if (found != bindings.end()) {
+			if (found->second.is_sequence)
+				error_handler("ERROR(scheme): " + symbol +
+					" must be followed by " + ellipsis + " -- " + name);
+			return found->second.form;
+		}
+		/* A free identifier is resolved where the macro is defined: the
+		 * special form, the macro or the global variable of the name, unless
+		 * it's a local variable there.
+		 */
+		if (rule.binders.count(symbol) == 0) {
+			if (data || scope_locals.count(symbol) != 0)
+				return tmpl;
+			return Object(symbol, KEYWORD);
+		}
+		/* Rename variables bound by the template, tmp --> tmp%1 */
+		auto renamed = renames.find(symbol);
+		if (renamed == renames.end())
+			renamed = renames.emplace(symbol, Object(symbol + "%" +
+				to_string(++rename_count), SYMBOL)).first;
+		return renamed->second;
+	}
+	if (tmpl.get_type() != CONS)
+		return tmpl;
+
+	/* (... ...) is the ellipsis itself */
+	if (is_ellipsis(car(tmpl)) && cdr(tmpl).get_type() == CONS)
+		return car(cdr(tmpl));
+
+	/* Quoted data and the rules of a macro defined by the template */
+	if (!data && (is_symbol(car(tmpl), "quote") ||
+		is_symbol(car(tmpl), "quasiquote") || is_symbol(car(tmpl), "syntax-rules")))
+		return Object(Cons(instantiate(car(tmpl), rule, bindings, renames, false),
+			instantiate(cdr(tmpl), rule, bindings, renames, true)));
+
+	/* (t ... . rest): instantiate t with each item of its sequences */
+	const Object& next = cdr(tmpl);
+	if (next.get_type() == CONS && is_ellipsis(car(next))) {
+		unordered_map<string, bool> is_sequence;
+		for (auto &binding : bindings)
+			is_sequence[binding.first] = binding.second.is_sequence;
+		vector<string> variables;
+		sequence_variables(car(tmpl), is_sequence, variables);
+		if (variables.empty())
+			error_handler("ERROR(scheme): no pattern variable before " +
+				ellipsis + " -- " + name);
+		size_t n = bindings.at(variables[0]).items.size();
+		for (auto &var : variables)
+			if (bindings.at(var).items.size() != n)
+				error_handler("ERROR(scheme): sequences of different lengths "
+					"before " + ellipsis + " -- " + name);
+
+		vector<Object> items;
+		for (size_t i = 0; i < n; i++) {
+			Bindings item_bindings(bindings);
+			for (auto &var : variables)
+				item_bindings[var] = bindings.at(var).items[i];
+			items.push_back(instantiate(car(tmpl), rule, item_bindings, renames,
+				data));
+		}
+		Object result = instantiate(cdr(next), rule, bindings, renames, data);
+		for (auto it = items.rbegin(); it != items.rend(); ++it)
+			result = Object(Cons(*it, result));
+		return result;
+	}
+
+	return Object(Cons(instantiate(car(tmpl), rule, bindings, renames, data),
+		instantiate(cdr(tmpl), rule, bindings, renames, data)));
+}
+
+Object Macro::expand(const Object& form, const vector<string>& shadowed) const
+{
+	for (auto &rule : rules) {
+		Bindings bindings;
+		if (match(cdr(rule.pattern), cdr(form), rule, bindings)) {
+			/* The template refers to a local variable by its name, which
+			 * means another variable where it's hidden.
+			 */
+			for (auto &var : shadowed)
+				if (rule.locals.count(var) != 0)
+					error_handler("ERROR(scheme): local variable " + var +
+						" of the macro is shadowed where it is used -- " + name);
+			Renames renames;
+			return instantiate(rule.tmpl, rule, bindings, renames, false);
+		}
+	}
+	error_handler("ERROR(scheme): no syntax rule matches -- " + name);
+}
+
+/* Definitions of derived forms */
+static const char* derived_forms = R"(
+(define-syntax let
+  (syntax-rules ()
+    ((_ ((name val) ...) body ...)
+     ((lambda (name ...) body ...) val ...))
+    ((_ tag ((name val) ...) body ...)
+     ((lambda () (define (tag name ...) body ...) (tag val ...))))))
+(define-syntax let*
+  (syntax-rules ()
+    ((_ () body ...) (let () body ...))
+    ((_ ((name val) rest ...) body ...)
+     (let ((name val)) (let* (rest ...) body ...)))))
+(define-syntax letrec
+  (syntax-rules ()
+    ((_ ((name val) ...) body ...)
+     ((lambda () (define name val) ... (let () body ...))))))
+(define-syntax letrec*
+  (syntax-rules ()
+    ((_ ((name val) ...) body ...)
+     ((lambda () (define name val) ... (let () body ...))))))
+(define-syntax cond
+  (syntax-rules (else =>)
+    ((_) (if #f #f))
+    ((_ (else result ...)) (begin result ...))
+    ((_ (test => f) clause ...)
+     (let ((t test)) (if t (f t) (cond clause ...))))
+    ((_ (test) clause ...) (or test (cond clause ...)))
+    ((_ (test result ...) clause ...)
+     (if test (begin result ...) (cond clause ...)))))
+(define-syntax case
+  (syntax-rules ()
+    ((_ key clause ...) (let ((k key)) (case-clauses k clause ...)))))
+(define-syntax case-clauses
+  (syntax-rules (else)
+    ((_ k) (if #f #f))
+    ((_ k (else result ...)) (begin result ...))
+    ((_ k ((datum ...) result ...) clause ...)
+     (if (or (equal? k 'datum) ...)
+         (begin result ...)
+         (case-clauses k clause ...)))))
+(define-syntax do
+  (syntax-rules ()
+    ((_ ((var init step ...) ...) (test expr ...) command ...)
+     (let loop ((var init) ...)
+       (if test
+           (begin (if #f #f) expr ...)
+           (begin command ... (loop (do "step" var step ...) ...)))))
+    ((_ "step" x) x)
+    ((_ "step" x y) y)))
+)";
+
+const MacroTable& builtin_macros()
+{
+	static const MacroTable macros = [] {
+		MacroTable table;
+		istringstream iss(derived_forms);
+		while (iss.good()) {
+			string input = get_input(iss);
+			if (input.empty())
+				continue;
+			vector<string> split = split_input(input);
+			size_t pos = 0;
+			while (pos < split.size()) {
+				Object form = read_datum(split, pos);
+				const string& name = car(cdr(form)).get_string();
+				table[name] = make_shared<Macro>(name, car(cdr(cdr(form))));
+			}
+		}
+		return table;
+	}();
+	return macros;
+}
+
+/* Return true if symbol occurs in exp */
+static bool contains_symbol(const Object& exp, const string& symbol)
+{
+	if (exp.get_type() == CONS)
+		return contains_symbol(car(exp), symbol) ||
+			contains_symbol(cdr(exp), symbol);
+	return is_symbol(exp, symbol);
+}
+
+static Object loop_tail(const Object& exp, const string& tag, const Object& id,
+	bool& ok);
+
+/* Compile the calls of tag in the last expression of body, the others must
+ * not use tag.
+ */
+static Object loop_body(const Object& body, const string& tag, const Object& id,
+	bool& ok)
+{
+	if (body.get_type() != CONS)
+		return body;
+	if (cdr(body).get_type() != CONS)
+		return Object(Cons(loop_tail(car(body), tag, id, ok), cdr(body)));
+	if (contains_symbol(car(body), tag))
+		ok = false;
+	return Object(Cons(car(body), loop_body(cdr(body), tag, id, ok)));
+}
+
+/* Compile the calls of tag in each expression of list, such as the branches
+ * of if.
+ */
+static Object loop_tail_list(const Object& list, const string& tag,
+	const Object& id, bool& ok)
+{
+	if (list.get_type() != CONS)
+		return list;
+	return Object(Cons(loop_tail(car(list), tag, id, ok),
+		loop_tail_list(cdr(list), tag, id, ok)));
+}
+
+/* Compile the calls of tag in tail positions of exp, an expanded expression
+ * of the body of loop id, "(tag arg ...)" --> "(%loop-next id arg ...)".
+ * ok is set to false if tag is used otherwise, such as "(+ 1 (tag x))",
+ * which needs a procedure tag.
+ */
+static Object loop_tail(const Object& exp, const string& tag, const Object& id,
+	bool& ok)
+{
+	if (exp.get_type() != CONS) {
+		if (is_symbol(exp, tag))
+			ok = false;
+		return exp;
+	}
+	const Object& head = car(exp);
+	const Object& operands = cdr(exp);
+	if (is_symbol(head, tag)) {
+		if (contains_symbol(operands, tag))
+			ok = false;
+		return Object(Cons(Object("%loop-next", SYMBOL), Object(Cons(id, operands))));
+	}
+	/* ((lambda (var ...) body ...) arg ...), such as let in the body */
+	if (head.get_type() == CONS && is_identifier(car(head), "lambda") &&
+		cdr(head).get_type() == CONS) {
+		const Object& params = car(cdr(head));
+		if (contains_symbol(params, tag) || contains_symbol(operands, tag)) {
+			ok = false;
+			return exp;
+		}
+		return Object(Cons(Object(Cons(car(head), Object(Cons(params,
+			loop_body(cdr(cdr(head)), tag, id, ok))))), operands));
+	}
+	if ((head.get_type() != SYMBOL && head.get_type() != KEYWORD) ||
+		operands.get_type() != CONS) {
+		if (contains_symbol(exp, tag))
+			ok = false;
+		return exp;
+	}
+
+	switch (head.get_special_form()) {
+	case SF_BEGIN: case SF_AND: case SF_OR:
+		return Object(Cons(head, loop_body(operands, tag, id, ok)));
+	/* The test of if, when and unless isn't in a tail position */
+	case SF_IF: case SF_WHEN: case SF_UNLESS: {
+		if (contains_symbol(car(operands), tag))
+			ok = false;
+		Object branches = head.get_special_form() == SF_IF ?
+			loop_tail_list(cdr(operands), tag, id, ok) :
+			loop_body(cdr(operands), tag, id, ok);
+		return Object(Cons(head, Object(Cons(car(operands), branches))));
+	}
+	/* (%loop id tag (var ...) (init ...) body ...) of a nested loop */
+	case SF_LOOP: {
+		Object rest = operands;
+		vector<Object> header;
+		for (int i = 0; i < 4 && rest.get_type() == CONS; i++, rest = cdr(rest))
+			header.push_back(car(rest));
+		for (auto &ob : header)
+			if (contains_symbol(ob, tag))
+				ok = false;
+		Object result = loop_body(rest, tag, id, ok);
+		for (auto it = header.rbegin(); it != header.rend(); ++it)
+			result = Object(Cons(*it, result));
+		return Object(Cons(head, result));
+	}
+	default:
+		if (contains_symbol(exp, tag))
+			ok = false;
+		return exp;
+	}
+}
+
+/* Macro defined by define-syntax in a body */
+struct LocalMacro {
+	string	name;
+	shared_ptr<const Macro>	macro;
+	size_t	depth;		/* Size of locals where the macro is defined */
+};
+
+/* State of expanding an expression */
+struct Expander {
+	MacroTable&		macros;
+	vector<string>	locals;		/* Variables bound by lambda and define */
+	vector<LocalMacro>	local_macros;	/* Macros of the bodies */
+	int				bodies;		/* Depth of bodies being expanded */
+
+	bool is_local(const string& symbol) const {
+		return find(locals.begin(), locals.end(), symbol) != locals.end();
+	}
+	/* Enter and leave a body, macros of the body are removed at the end */
+	size_t enter_body() {
+		bodies++;
+		return local_macros.size();
+	}
+	void leave_body(size_t depth, size_t macro_depth) {
+		bodies--;
+		locals.resize(depth);
+		local_macros.resize(macro_depth);
+	}
+	/* Return the macro named by the first element of exp, or nullptr;
+	 * shadowed is set to the variables bound after a macro of a body.
+	 */
+	const Macro* find_macro(const Object& exp, vector<string>& shadowed) const;
+
+	Object expand(const Object& exp);
+	Object expand_list(const Object& list);
+	Object expand_lambda(const Object& params, const Object& body);
+	Object expand_clauses(const Object& clauses);
+	Object expand_quasiquote(const Object& tmpl, int depth);
+	Object expand_loop(const Object& form);
+};
+
+const Macro* Expander::find_macro(const Object& exp,
+	vector<string>& shadowed) const
+{
+	const Object& head = car(exp);
+	shadowed.clear();
+	/* A free identifier of a template isn't hidden by local variables, it's
+	 * a builtin macro if a global definition has replaced the macro.
+	 */
+	if (head.get_type() == KEYWORD) {
+		if (head.get_special_form() != NOT_SPECIAL)
+			return nullptr;
+		auto found = macros.find(head.get_string());
+		if (found != macros.end())
+			return found->second.get();
+		auto builtin = builtin_macros().find(head.get_string());
+		return builtin == builtin_macros().end() ? nullptr : builtin->second.get();
+	}
+	if (head.get_type() != SYMBOL)
+		return nullptr;
+	/* The last macro of a body, unless a variable defined after it hides it */
+	for (auto it = local_macros.rbegin(); it != local_macros.rend(); ++it) {
+		if (it->name != head.get_string())
+			continue;
+		for (size_t i = it->depth; i < locals.size(); i++)
+			if (locals[i] == it->name)
+				return nullptr;
+		/* Variables and macros bound after the macro */
+		shadowed.assign(locals.begin() + it->depth, locals.end());
+		for (auto later = local_macros.rbegin(); later != it; ++later)
+			shadowed.push_back(later->name);
+		return it->macro.get();
+	}
+	if (macros.empty())
+		return nullptr;
+	auto found = macros.find(head.get_string());
+	if (found == macros.end() || is_local(head.get_string()))
+		return nullptr;
+	return found->second.get();
+}
+
+Object Expander::expand_list(const Object& list)
+{
+	if (list.get_type() != CONS)
+		return list;
+	/* In order, a define-syntax applies to the expressions after it */
+	Object first = expand(car(list));
+	return Object(Cons(first, expand_list(cdr(list))));
+}
+
+/* Expand body of a procedure, params are bound in body */
+Object Expander::expand_lambda(const Object& params, const Object& body)
+{
+	size_t depth = locals.size(), macro_depth = enter_body();
+	const Object* param = &params;
+	for (; param->get_type() == CONS; param = &cdr(*param))
+		if (car(*param).get_type() == SYMBOL)
+			locals.push_back(car(*param).get_string());
+	if (param->get_type() == SYMBOL)
+		locals.push_back(param->get_string());
+	Object result = expand_list(body);
+	leave_body(depth, macro_depth);
+	return result;
+}
+
+/* Expand clauses of case-lambda, ((params body ...) ...) */
+Object Expander::expand_clauses(const Object& clauses)
+{
+	if (clauses.get_type() != CONS)
+		return clauses;
+	const Object& clause = car(clauses);
+	Object expanded = clause.get_type() != CONS ? clause :
+		Object(Cons(car(clause), expand_lambda(car(clause), cdr(clause))));
+	return Object(Cons(expanded, expand_clauses(cdr(clauses))));
+}
+
+Object Expander::expand_quasiquote(const Object& tmpl, int depth)
+{
+	if (tmpl.get_type() != CONS)
+		return tmpl;
+	const Object& head = car(tmpl);
+	if ((is_symbol(head, "unquote") || is_symbol(head, "unquote-splicing")) &&
+		cdr(tmpl).get_type() == CONS) {
+		if (depth == 1)
+			return Object(Cons(head, expand_list(cdr(tmpl))));
+		return Object(Cons(head, expand_quasiquote(cdr(tmpl), depth - 1)));
+	}
+	if (is_symbol(head, "quasiquote"))
+		return Object(Cons(head, expand_quasiquote(cdr(tmpl), depth + 1)));
+	Object first = expand_quasiquote(head, depth);
+	return Object(Cons(first, expand_quasiquote(cdr(tmpl), depth)));
+}
+
+/* Compile named let "(let tag ((var init) ...) body ...)" to a loop, such as
+ * "(%loop id tag (var ...) (init ...) body ...)", if tag is only called in
+ * tail positions of body; otherwise return an unassigned object, and the
+ * named let is expanded to a procedure tag.
+ */
+Object Expander::expand_loop(const Object& form)
+{
+	const Object& tag = car(cdr(form));
+	const Object& rest = cdr(cdr(form));
+	if (rest.get_type() != CONS)
+		return Object();
+	vector<Object> vars, inits;
+	const Object* binding = &car(rest);
+	for (; binding->get_type() == CONS; binding = &cdr(*binding)) {
+		const Object& one = car(*binding);
+		if (one.get_type() != CONS || car(one).get_type() != SYMBOL ||
+			cdr(one).get_type() != CONS || cdr(cdr(one)).get_type() != NIL)
+			return Object();
+		vars.push_back(car(one));
+		inits.push_back(expand(car(cdr(one))));
+	}
+	if (binding->get_type() != NIL)
+		return Object();
+
+	/* tag and vars are bound in body */
+	size_t depth = locals.size(), macro_depth = enter_body();
+	locals.push_back(tag.get_string());
+	for (auto &var : vars)
+		locals.push_back(var.get_string());
+	Object body = expand_list(cdr(rest));
+	leave_body(depth, macro_depth);
+
+	Object id(++loop_count);
+	bool ok = true;
+	body = loop_body(body, tag.get_string(), id, ok);
+	if (!ok)
+		return Object();
+
+	Object var_list = make_nil(), init_list = make_nil();
+	for (size_t i = vars.size(); i-- > 0; ) {
+		var_list = Object(Cons(vars[i], var_list));
+		init_list = Object(Cons(inits[i], init_list));
+	}
+	return Object(Cons(Object("%loop", SYMBOL), Object(Cons(id, Object(Cons(tag,
+		Object(Cons(var_list, Object(Cons(init_list, body))))))))));
+}
+
+Object Expander::expand(const Object& exp)
+{
+	if (exp.get_type() != CONS)
+		return exp;
+
+	/* Expand macros until exp isn't a macro call, a named let of the
+	 * builtin let may be compiled to a loop, do is expanded to one.
+	 */
+	static const Macro* builtin_let = builtin_macros().at("let").get();
+	Object form = exp;
+	vector<string> shadowed;
+	while (const Macro* macro = find_macro(form, shadowed)) {
+		if (macro == builtin_let && cdr(form).get_type() == CONS &&
+			car(cdr(form)).get_type() == SYMBOL) {
+			Object loop = expand_loop(form);
+			if (loop.get_type() == CONS)
+				return loop;
+		}
+		form = macro->expand(form, shadowed);
+		if (form.get_type() != CONS)
+			return form;
+	}
+
+	const Object& head = car(form);
+	if (!(head.get_type() == KEYWORD ||
+		(head.get_type() == SYMBOL && !is_local(head.get_string()))) ||
+		cdr(form).get_type() != CONS)
+		return expand_list(form);
+	const string& keyword = head.get_string();
+	const Object& operands = cdr(form);
+
+	/* (define-syntax name (syntax-rules ...)) */
+	if (keyword == "define-syntax") {
+		if (car(operands).get_type() != SYMBOL || cdr(operands).get_type() != CONS)
+			error_handler("ERROR(scheme): ill-formed special form -- "
+				"define-syntax");
+		const string& name = car(operands).get_string();
+		if (bodies == 0)
+			macros[name] = make_shared<Macro>(name, car(cdr(operands)));
+		else {
+			/* Templates refer to the variables and macros of the body, and
+			 * to the macro itself.
+			 */
+			vector<string> scope(locals);
+			for (auto &local : local_macros)
+				scope.push_back(local.name);
+			scope.push_back(name);
+			local_macros.push_back(LocalMacro{ name,
+				make_shared<Macro>(name, car(cdr(operands)), scope), locals.size() });
+		}
+		return Object(Cons(Object("quote", SYMBOL),
+			Object(Cons(car(operands), make_nil()))));
+	}
+
+	switch (head.get_special_form()) {
+	case SF_QUOTE:
+	case SF_LOOP:	/* Compiled by expand_loop() */
+		return form;
+	case SF_QUASIQUOTE:
+		return Object(Cons(head, expand_quasiquote(operands, 1)));
+	case SF_LAMBDA:
+		return Object(Cons(head, Object(Cons(car(operands),
+			expand_lambda(car(operands), cdr(operands))))));
+	case SF_CASE_LAMBDA:
+		return Object(Cons(head, expand_clauses(operands)));
+	case SF_DEFINE: {
+		const Object& target = car(operands);
+		const Object& name = target.get_type() == CONS ? car(target) : target;
+		/* A global definition replaces the macro of the same name, a
+		 * local one hides it in the rest of the body.
+		 */
+		if (name.get_type() == SYMBOL) {
+			if (bodies == 0)
+				macros.erase(name.get_string());
+			else
+				locals.push_back(name.get_string());
+		}
+		/* (define (f x) body) */
+		if (target.get_type() == CONS)
+			return Object(Cons(head, Object(Cons(target,
+				expand_lambda(cdr(target), cdr(operands))))));
+		return Object(Cons(head, Object(Cons(target,
+			expand_list(cdr(operands))))));
+	}
+	default:
+		return expand_list(form);
+	}
+}
+
+Object expand(const Object& exp)
+{
+	Expander expander{ current_interpreter().macros, {}, {}, 0 };
+	return expander.expand(exp);
+}
@@ -0,0 +1,108 @@
+/* Header file of macros */
+
+#ifndef MACRO_H_
+#define MACRO_H_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+using namespace std;
+
+#include "object.h"
+
+/* Macro: a transformer defined by syntax-rules, such as
+ * (define-syntax swap!
+ *   (syntax-rules ()
+ *     ((_ a b) (let ((tmp a)) (set! a b) (set! b tmp)))))
+ * Variables bound by a template, such as "tmp", are renamed in every
+ * expansion, so they don't capture the variables of the caller. Other
+ * identifiers of a template, such as "let" and "set!", are free: they are
+ * instantiated as KEYWORD objects, which mean the special form, the macro or
+ * the global variable of the name even if the caller binds the name.
+ */
+class Macro {
+public:
+	/* spec is (syntax-rules (literal ...) (pattern template) ...), or
+	 * (syntax-rules ellipsis (literal ...) (pattern template) ...);
+	 * scope is the local variables and macros where the macro is defined,
+	 * templates refer to them by their names.
+	 */
+	Macro(const string& macro_name, const Object& spec,
+		const vector<string>& scope = {});
+	Macro(const Macro&) = delete;
+	Macro& operator=(const Macro&) = delete;
+
+	/* Expand form by the first rule whose pattern matches it; shadowed are
+	 * the variables bound between the macro and form, the template of the
+	 * rule must not refer to the local variables of the same names.
+	 */
+	Object expand(const Object& form, const vector<string>& shadowed = {}) const;
+
+	const string& get_name() const { return name; }
+
+private:
+	/* Bound form of a pattern variable, a variable followed by ellipsis
+	 * is bound to a sequence of forms.
+	 */
+	struct Binding {
+		Object			form;
+		vector<Binding>	items;
+		bool			is_sequence = false;
+	};
+	using Bindings = unordered_map<string, Binding>;
+	using Renames = unordered_map<string, Object>;
+
+	struct Rule {
+		Object	pattern;
+		Object	tmpl;
+		unordered_set<string>	variables;	/* Pattern variables */
+		unordered_set<string>	binders;	/* Variables bound by tmpl */
+		unordered_set<string>	locals;		/* Local variables used by tmpl */
+	};
+
+	bool is_ellipsis(const Object& ob) const;
+	bool is_literal(const string& symbol) const;
+	/* Add the pattern variables of pattern to variables */
+	void pattern_variables(const Object& pattern,
+		unordered_set<string>& variables) const;
+	/* Add the variables bound by lambda, let, do and define of tmpl to
+	 * binders.
+	 */
+	void template_binders(const Object& tmpl, const Rule& rule,
+		unordered_set<string>& binders) const;
+	/* Add the local variables of scope used by tmpl to locals, the
+	 * identifiers of quasiquote templates are counted.
+	 */
+	void template_locals(const Object& tmpl, const Rule& rule,
+		unordered_set<string>& locals) const;
+
+	bool match(const Object& pattern, const Object& form,
+		const Rule& rule, Bindings& bindings) const;
+	/* data is true in quoted data, whose symbols aren't free identifiers */
+	Object instantiate(const Object& tmpl, const Rule& rule,
+		const Bindings& bindings, Renames& renames, bool data) const;
+
+	string			name;
+	string			ellipsis;
+	vector<string>	literals;
+	vector<Rule>	rules;
+	unordered_set<string>	scope_locals;	/* See the constructor */
+};
+
+using MacroTable = unordered_map<string, shared_ptr<const Macro>>;
+
+/* Derived forms: let, let*, letrec, letrec*, cond, case and do. They are
+ * built once and shared by all interpreters.
+ */
+const MacroTable& builtin_macros();
+
+/* Expand the macros of exp and register the macros of define-syntax,
+ * in the macros of current interpreter; a define-syntax in a body defines
+ * a macro of the rest of the body. Expressions are expanded once
+ * before they are evaluated, procedures keep expanded bodies.
+ */
+Object expand(const Object& exp);
+
+#endif
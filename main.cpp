@@ -6,25 +6,112 @@ using namespace std;
 #include "object.h"
 #include "io_function.h"
 #include "eval.h"
+#include "port.h"
 
-/* test.cpp */
-void run_test();
+/* Statistics of main interpreter, written by write_stats at exit */
+static shared_ptr<RuntimeStats> main_stats;
+
+/* Write statistics to the file named by SCHEME_STATS */
+static void write_stats()
+{
+	update_cons_count();	/* exit() may be called by (quit) */
+	OutputPort port(unique_ptr<ostream>(new ofstream(getenv("SCHEME_STATS"))));
+	main_stats->write_json(port);
+}
+
+/* Write the last events to the file named by SCHEME_TRACE */
+static void write_trace()
+{
+	trace_stop();
+	OutputPort port(unique_ptr<ostream>(new ofstream(getenv("SCHEME_TRACE"))));
+	trace_dump(port);
+}
 
 int main(int argc, char **argv)
 {
-	initialize_environment();
+	Interpreter interp;
+
+	/* SCHEME_STATS=path: collect statistics, write them to path as JSON */
+	if (getenv("SCHEME_STATS") != nullptr) {
+		interp.stats = main_stats = make_shared<RuntimeStats>();
+		atexit(write_stats);
+	}
 
-#if 1
-	run_test();
-#endif
+	/* SCHEME_TRACE=path: trace the run, write the last events of each
+	 * thread to path as Chrome trace-event JSON, SCHEME_TRACE_SIZE is the
+	 * number of events kept by each thread.
+	 */
+	if (getenv("SCHEME_TRACE") != nullptr) {
+		const char* size = getenv("SCHEME_TRACE_SIZE");
+		trace_start(size != nullptr && atol(size) > 0 ? 
+			atol(size) : TRACE_CAPACITY);
+		atexit(write_trace);
+	}
+
+	/* "--map-lines proc.scm": proc.scm returns a procedure, call it with
+	 * each line of standard input, such as "(lambda (line) line)".
+	 */
+	if (argc == 3 && string(argv[1]) == "--map-lines") {
+		ifstream input(argv[2], ifstream::in);
+		if (!input) {
+			cerr << "ERROR(runtime): couldn't open file -- " << argv[2] << endl;
+			return 1;
+		}
+		ios::sync_with_stdio(false);
+		/* Standard input is data, don't ask user to continue on errors */
+		try {
+			map_lines(interp, cin, run_evaluator(interp, input, 1));
+		}
+		catch (const SchemeError& e) {
+			interp.output_port->flush();
+			cerr << e.what() << endl;
+			return 1;
+		}
+		return 0;
+	}
+
+	/* "--profile file.scm": evaluate file.scm with the profiler, print the
+	 * report to standard error, and the folded stacks to profile.folded.
+	 */
+	if (argc == 3 && string(argv[1]) == "--profile") {
+		ifstream input(argv[2], ifstream::in);
+		if (!input) {
+			cerr << "ERROR(runtime): couldn't open file -- " << argv[2] << endl;
+			return 1;
+		}
+		int status = 0;
+		interp.profiler = make_shared<Profiler>(1);
+		try {
+			run_evaluator(interp, input, 1);
+		}
+		catch (const SchemeError& e) {
+			interp.output_port->flush();
+			cerr << e.what() << endl;
+			status = 1;
+		}
+		interp.profiler->stop_timer();
+		interp.output_port->flush();
+		OutputPort report(cerr);
+		interp.profiler->report(report);
+		OutputPort folded(unique_ptr<ostream>(new ofstream("profile.folded")));
+		interp.profiler->report_folded(folded);
+		return status;
+	}
 
 	if (argc == 1)
-		run_evaluator(std::cin);
+		run_evaluator(interp, std::cin);
 	else {
 		/* Load code from file to evaluate */
 		ifstream input(argv[1], ifstream::in);
-		if (input)
-			run_evaluator(input, 1);
+		if (input) {
+			try {
+				run_evaluator(interp, input, 1);
+			}
+			catch (const SchemeError& e) {
+				report_error(e.what());
+				run_evaluator(interp, cin);
+			}
+		}
 		else
 			cerr << "ERROR(runtime): couldn't open file -- " << argv[1] << endl;
 	}
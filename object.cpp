@@ -3,10 +3,28 @@
 #include "object.h"
 #include "eval.h"
 
+thread_local size_t cons_allocated = 0;
+
+Object::Object(const string& s, int t) : type(t), integer(NOT_SPECIAL), str(s)
+{
+	if (type == KEYWORD || type == SYMBOL)
+		integer = special_form(s);
+}
+
+/* Procedure is moved, compound procedures keep their frames */
+Object::Object(Procedure p) :
+	type(PROCEDURE), proc(make_shared<Procedure>(std::move(p)))
+{
+}
+
 void Object::copy_inner(const Object& ob)
 {
-	if (type == STRING || type == KEYWORD)
+	if (type == STRING)
+		text = ob.text;
+	else if (type == KEYWORD || type == SYMBOL || type == CHAR) {
 		str = ob.get_string();
+		integer = ob.integer;
+	}
 	else if (type == INTEGER)
 		integer = ob.get_integer();
 	else if (type == REAL)
@@ -17,6 +35,12 @@ void Object::copy_inner(const Object& ob)
 		proc = ob.get_proc();
 	else if (type == CONS)
 		cons = ob.get_cons();
+	else if (type == PORT)
+		port = ob.get_port();
+	else if (type == THREAD)
+		sthread = ob.get_thread();
+	else if (type == CHANNEL)
+		channel = ob.get_channel();
 #ifdef USE_LIST
 	else if (type == LIST)
 		lst = ob.get_list();
@@ -27,13 +51,48 @@ Object::Object(const Object& ob) : type(ob.get_type()) {
 	copy_inner(ob);
 }
 
+/* Same as copy_inner, but take the resources of ob */
+void Object::move_inner(Object& ob)
+{
+	if (type == STRING)
+		text = std::move(ob.text);
+	else if (type == KEYWORD || type == SYMBOL || type == CHAR) {
+		str = std::move(ob.str);
+		integer = ob.integer;
+	}
+	else if (type == PROCEDURE)
+		proc = std::move(ob.proc);
+	else if (type == CONS)
+		cons = std::move(ob.cons);
+	else if (type == PORT)
+		port = std::move(ob.port);
+	else if (type == THREAD)
+		sthread = std::move(ob.sthread);
+	else if (type == CHANNEL)
+		channel = std::move(ob.channel);
+	else
+		copy_inner(ob);
+}
+
+Object::Object(Object&& ob) noexcept : type(ob.get_type()) {
+	move_inner(ob);
+}
+
 Object& Object::operator=(const Object& ob) {
 	type = ob.get_type();
 	copy_inner(ob);
 	return *this;
 }
 
-bool Object::operator_inner(const Object& ob, const string& op) {
+Object& Object::operator=(Object&& ob) noexcept {
+	if (this != &ob) {
+		type = ob.get_type();
+		move_inner(ob);
+	}
+	return *this;
+}
+
+bool Object::operator_inner(const Object& ob, const string& op) const {
 	if (op != "<" && op != ">" && op != "==") 
 		error_handler(string("ERROR(runtime): Object::operator_inner() takes") + 
 			" <, >, = as second argument");
@@ -51,7 +110,7 @@ bool Object::operator_inner(const Object& ob, const string& op) {
 		(op == ">" ? (lhs > rhs) : (abs(lhs - rhs) <= 1e-9)));
 }
 
-bool Object::operator==(const Object& ob) {
+bool Object::operator==(const Object& ob) const {
 	int type2 = ob.get_type();
 
 	if (type != type2)
@@ -60,7 +119,9 @@ bool Object::operator==(const Object& ob) {
 		return integer == ob.get_integer();
 	else if (type == REAL)
 		return abs(real - ob.get_real()) <= 1e-9;
-	else if (type == STRING || type == KEYWORD)
+	else if (type == STRING)
+		return text == ob.text || *text == *ob.text;
+	else if (type == KEYWORD || type == SYMBOL || type == CHAR)
 		return str == ob.get_string();
 	else if (type == BOOLEAN)
 		return boolean == ob.get_boolean();
@@ -68,24 +129,31 @@ bool Object::operator==(const Object& ob) {
 		return proc == ob.get_proc();
 	else if (type == CONS)
 		return cons == ob.get_cons();
+	else if (type == PORT)
+		return port == ob.get_port();
+	else if (type == THREAD)
+		return sthread == ob.get_thread();
+	else if (type == CHANNEL)
+		return channel == ob.get_channel();
 #ifdef USE_LIST
 	else if (type == LIST)
 		return lst == ob.get_list();
 #endif
-	return true; // UNASSIGNED
+	return true; // UNASSIGNED, NIL, EOF_OBJECT
 }
 
-bool Object::operator<(const Object& ob) {
+bool Object::operator<(const Object& ob) const {
 	return operator_inner(ob, "<");
 }
 
-bool Object::operator>(const Object& ob) {
+bool Object::operator>(const Object& ob) const {
 	return operator_inner(ob, ">");
 }
 
 static vector<string> type_str{
 	"unassigned", "integer", "real", "boolean",
-	"string", "procedure", "cons", "list", "keyword"
+	"string", "procedure", "cons", "list", "keyword", "symbol",
+	"char", "port", "eof", "thread", "channel"
 };
 
 string Object::get_type_str() const {
@@ -96,7 +164,7 @@ Cons::Cons(const vector<Object> &obs) {
 	if (obs.size() != 2)
 		error_handler("ERROR(scheme): number of operands number must be 2 "
 			"-- cons, usage: (cons 1 2)"
-#ifndef NDEBUG
+#ifdef SCHEME_DEBUG
 			"\nDEBUG: Construct: Cons(const vector<Object>&)"
 #endif
 		);
@@ -9,18 +9,30 @@
 #include <unordered_map>
 #include <list>
 #include <memory>
+#include <functional>
+#include <mutex>
 using namespace std;
 
+#include "tracer.h"
+
 //#define USE_LIST
 
 class Procedure;
+struct Frame;
 class Cons;
 class List;
+class Port;
+class SchemeThread;
+class Channel;
+
+/* Number of pairs allocated by current thread, see RuntimeStats */
+extern thread_local size_t cons_allocated;
 
 /* Types of data */
 enum { 
 	UNASSIGNED = 0, INTEGER, REAL, BOOLEAN, 
-	STRING, PROCEDURE, CONS, NIL, /*LIST,*/ KEYWORD
+	STRING, PROCEDURE, CONS, NIL, /*LIST,*/ KEYWORD, SYMBOL,
+	CHAR, PORT, EOF_OBJECT, THREAD, CHANNEL
 };
 
 /* Object save several kinds of data */
@@ -29,27 +41,44 @@ public:
 	/* Constructor */
 	Object() : type(UNASSIGNED) {}
 	Object(const Object& ob);
+	/* Move, used when values are returned and stored into vectors */
+	Object(Object&& ob) noexcept;
 	
 	explicit Object(int val) :			type(INTEGER),	integer(val){}
 	explicit Object(double val) :		type(REAL),		real(val) {}
 	explicit Object(bool val) :			type(BOOLEAN),	boolean(val) {}
-	explicit Object(const string& s) :	type(STRING),	str(s) {}
-	explicit Object(const char* s) :	type(STRING),	str(s) {}
-	explicit Object(const Procedure& p) :
-		type(PROCEDURE), proc(make_shared<Procedure>(p)) {}
+	/* String of the characters of s, such as Object("a\"b") --> "a\"b" */
+	explicit Object(const string& s) :
+		type(STRING), text(make_shared<const string>(s)) {}
+	explicit Object(string&& s) :
+		type(STRING), text(make_shared<const string>(std::move(s))) {}
+	explicit Object(const char* s) :
+		type(STRING), text(make_shared<const string>(s)) {}
+	explicit Object(Procedure p);
 	explicit Object(const Cons& c) : 
-		type(CONS), cons(make_shared<Cons>(c)) {}
+		type(CONS), cons(make_shared<Cons>(c)) {
+		if (tracing())
+			trace_record(TRACE_ALLOC, "cons", 4, cons_allocated + 1);
+		cons_allocated++;
+	}
+	explicit Object(const shared_ptr<Port>& p) : type(PORT), port(p) {}
+	explicit Object(const shared_ptr<SchemeThread>& t) : 
+		type(THREAD), sthread(t) {}
+	explicit Object(const shared_ptr<Channel>& c) : 
+		type(CHANNEL), channel(c) {}
 #ifdef USE_LIST
 	explicit Object(const List& l) : 
 		type(LIST), lst(make_shared<List>(l)) {}
 #endif
-	Object(const string& s, int t) : type(t), str(s) {}
+	/* Symbols and keywords keep their special forms, see eval.h */
+	Object(const string& s, int t);
 
 	/* Operator and destructor */
 	Object& operator=(const Object& ob);
-	bool operator==(const Object& ob);
-	bool operator<(const Object& ob);
-	bool operator>(const Object& ob);
+	Object& operator=(Object&& ob) noexcept;
+	bool operator==(const Object& ob) const;
+	bool operator<(const Object& ob) const;
+	bool operator>(const Object& ob) const;
 	~Object() {}
 
 	/* Others */
@@ -60,26 +89,42 @@ public:
 	double get_real() const { return real; }
 	bool is_number() const { return type == INTEGER || type == REAL; }
 	bool get_boolean() const { return boolean; }
-	string get_string() const { return str; }
-	shared_ptr<Procedure> get_proc() const { return proc; }
-	shared_ptr<Cons> get_cons() const { return cons; };
+	/* Characters of a string, name of a symbol or keyword, or a char */
+	const string& get_string() const { return type == STRING ? *text : str; }
+	/* Return the special form named by a symbol, such as SF_IF of "if",
+	 * NOT_SPECIAL if it's not a keyword, see eval.h.
+	 */
+	int get_special_form() const { return integer; }
+	const shared_ptr<Procedure>& get_proc() const { return proc; }
+	const shared_ptr<Cons>& get_cons() const { return cons; };
+	shared_ptr<Port> get_port() const { return port; }
+	shared_ptr<SchemeThread> get_thread() const { return sthread; }
+	shared_ptr<Channel> get_channel() const { return channel; }
 #ifdef USE_LIST
 	shared_ptr<List> get_list() const { return lst; }
 #endif
 	/* Used to operator< and operator> */
-	bool operator_inner(const Object& ob, const string& op);
+	bool operator_inner(const Object& ob, const string& op) const;
 	
 private:
 	/* Used to copy constructor and copy control*/
 	void copy_inner(const Object& ob); 
+	void move_inner(Object& ob);
 
 	int						type;
 	int						integer;
 	double					real;
 	bool					boolean;
 	string					str;
+	/* Characters of a string, strings are immutable, so copies share them
+	 * and the length is known without scanning.
+	 */
+	shared_ptr<const string>	text;
 	shared_ptr<Procedure>	proc;
 	shared_ptr<Cons>		cons;
+	shared_ptr<Port>		port;
+	shared_ptr<SchemeThread>	sthread;
+	shared_ptr<Channel>		channel;
 #ifdef USE_LIST
 	shared_ptr<List>		lst;
 #endif
@@ -89,8 +134,9 @@ private:
 enum { UNKNOWN = 0, PRIMITIVE, COMPOUND };
 
 /* Procedure: 
- * save primitive procedure as a function pointer, implemented in 
- * primitive_procedures.cpp;
+ * save primitive procedure as a function, implemented in 
+ * primitive_procedures.cpp or registered by the program which embeds
+ * the interpreter, see Interpreter::define_procedure();
  * save compound procedure as a vector of parameters and a vector of body.
  */
 class Procedure {
@@ -98,63 +144,85 @@ public:
 	/* Constructor */
 	Procedure() : type(UNKNOWN) {}
 
+	/* Primitive procedure, a function pointer or a lambda with captures */
+	using PrimitiveFunc = function<Object(const vector<Object>&)>;
+
 	/* Primitive procedure constructor */
-	Procedure(Object(*f)(vector<Object>&), const string& proc_name) :
-		type(PRIMITIVE), name(proc_name), func(f), parameters({}), body({}),
-		static_env(StaticEnv()) {}
-
-	/* Compound procedure constructor */
-	Procedure(const vector<string>& params, const vector<string>& bdy, 
-		const string& proc_name): type(COMPOUND), name(proc_name), 
-		func(nullptr), parameters(params), body(bdy), 
-		static_env(StaticEnv()) {}
-
-	/* Static environment, store static local variable. */
-	/* Same type with SubEnv -- eval.h, and it could be changed/modified. */
-	using StaticEnv = unordered_map<string, Object>;
-
-	/* Anonymous procedure constructor */
-	Procedure(const vector<string>& params, const vector<string>& bdy, 
-		const string& proc_name, const StaticEnv& env) : 
-		type(COMPOUND), name(proc_name), func(nullptr),
-		parameters(params), body(bdy), static_env(env) {}
+	Procedure(PrimitiveFunc f, const string& proc_name) :
+		type(PRIMITIVE), name(proc_name), func(std::move(f)) {}
+
+	/* Compound procedure constructor, env is the frame where the procedure
+	 * is created, null if it's created in the global environment; defines
+	 * are the names defined by the body, rest_param is bound to the list of
+	 * the extra arguments, such as "r" of (lambda (a . r) ...), see
+	 * eval_lambda().
+	 */
+	Procedure(const vector<string>& params, const Object& bdy, 
+		const string& proc_name, shared_ptr<Frame> env = nullptr,
+		vector<string> defs = {}, const string& rest_param = "") :
+		type(COMPOUND), name(proc_name), func(nullptr), parameters(params),
+		rest(rest_param), defines(std::move(defs)), body(bdy),
+		static_env(std::move(env)) {}
 
-	/* Destructor */
-	~Procedure() {}
+	/* case-lambda constructor, a call is evaluated by the first clause which
+	 * accepts the number of arguments in the frame of env; clauses are
+	 * compound procedures without frames.
+	 */
+	Procedure(vector<shared_ptr<Procedure>> cls, const string& proc_name,
+		shared_ptr<Frame> env) :
+		type(COMPOUND), name(proc_name), func(nullptr),
+		static_env(std::move(env)), clauses(std::move(cls)) {}
 
 	/* Others */
 	int get_type() const { return type; }
-	string get_proc_name() const { return name; }
-	/* Return a function pointer -- primitive procedure */
-	Object(*get_primitive()) (vector<Object>&)  { return func; }
+	const string& get_proc_name() const { return name; }
+	/* Return the function of primitive procedure */
+	const PrimitiveFunc& get_primitive() const { return func; }
 
 	/* Return parameters and body of compound procedure */
-	vector<string> get_parameters() const { return parameters; }
-	vector<string> get_body() const { return body; }
-
-	/* Return static_env, used to expand evaluator's environment. */
-	StaticEnv get_env() const { return static_env; } 
-	/* Define a new variable or update a existed variable in static_env. */
-	void set_env(const string& variable, const Object& value) {
-		static_env[variable] = value;
+	const vector<string>& get_parameters() const { return parameters; }
+	/* Rest parameter, empty if the procedure takes a fixed number of
+	 * arguments.
+	 */
+	const string& get_rest() const { return rest; }
+	bool has_rest() const { return !rest.empty(); }
+	/* Return true if the procedure can be called with n arguments */
+	bool accepts(size_t n) const {
+		return n == parameters.size() || (has_rest() && n > parameters.size());
 	}
+	/* Clauses of case-lambda, empty for other procedures */
+	const vector<shared_ptr<Procedure>>& get_clauses() const { return clauses; }
+	/* Names defined by the body, they are bound in the frame of a call
+	 * before the body is evaluated, such as helpers which call each other.
+	 */
+	const vector<string>& get_defines() const { return defines; }
+	/* Body is a list of expressions, such as ((define c 4) (+ a b c)) */
+	const Object& get_body() const { return body; }
+
+	/* Return the frame where the procedure was created, the frames of its
+	 * calls are linked to it. The frame is shared with other closures.
+	 */
+	const shared_ptr<Frame>& get_env() const { return static_env; }
 private:
 	int		type;		/* Type of procedure, PRIMITIVE or COMPOUND */
 	string	name;		/* name of procedure */
 
 	/* Primitive procedure, such as +, square */
-	Object(*func)(vector<Object>&);	
+	PrimitiveFunc	func;
 
 	/* Compound procedure */
-	struct {
-		vector<string>	parameters;	/* Store parameters of "lambda" expression*/
-		vector<string>	body;		/* Store body of "lambda" expression*/
-		StaticEnv		static_env;	/* Store static variables */
-	};
+	vector<string>	parameters;	/* Store parameters of "lambda" expression*/
+	string			rest;		/* Rest parameter, bound to a list */
+	vector<string>	defines;	/* Names defined by the body */
+	Object			body;		/* Store body of "lambda" expression*/
+	shared_ptr<Frame>	static_env;	/* Frame where it was created */
+	vector<shared_ptr<Procedure>>	clauses;	/* Clauses of case-lambda */
 
 	/* Why not choose to use string to save compound procedures:
 	 * Every time we apply arguments to compound procedure, the Evaluator must 
 	 * split the string into parameters and boyd, it will take time to do this.
+	 * The body is kept as data built by the reader, so quoted constants in
+	 * it are constructed only once.
 	 */
 	// string proc;		/* Compound procudere, such as (lambda (x) (+ x 1)) */
 };
@@ -169,9 +237,9 @@ public:
 
 	~Cons() {}
 
-	/* Others */
-	Object car() const { return pir.first; }
-	Object cdr() const { return pir.second; }
+	/* Others, the elements are valid while the pair is alive */
+	const Object& car() const { return pir.first; }
+	const Object& cdr() const { return pir.second; }
 
 	void set_car(const Object& val) { pir.first = val; }
 	void set_cdr(const Object& val) { pir.second = val; }
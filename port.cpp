@@ -0,0 +1,221 @@
+/* Implement of input and output ports */
+
+#include <cstdio>
+#include <cstring>
+#include "port.h"
+#include "io_function.h"
+
+void OutputPort::put(const char* s, size_t n)
+{
+	/* Large string, write it to the stream directly */
+	if (n >= BUFFER_SIZE) {
+		write_buffer();
+		out->write(s, n);
+		return;
+	}
+	if (count + n > BUFFER_SIZE)
+		write_buffer();
+	memcpy(buffer + count, s, n);
+	count += n;
+}
+
+void OutputPort::put(const char* s)
+{
+	put(s, strlen(s));
+}
+
+void OutputPort::write_buffer()
+{
+	if (out == nullptr) {
+		count = 0;
+		error_handler("ERROR(scheme): the output port has been closed");
+	}
+	if (count > 0)
+		out->write(buffer, count);
+	count = 0;
+}
+
+void OutputPort::flush()
+{
+	write_buffer();
+	out->flush();
+}
+
+void OutputPort::close()
+{
+	if (out == nullptr)
+		return;
+	flush();
+	out = nullptr;
+	owner.reset();
+}
+
+/* Print a string in the form that can be read, such as a"b<newline> -->
+ * "a\"b\n".
+ */
+static void write_string(OutputPort& port, const string& str)
+{
+	port.put('"');
+	for (char c : str) {
+		if (c == '"' || c == '\\')
+			port.put('\\');
+		if (c == '\n')
+			port.put("\\n");
+		else if (c == '\t')
+			port.put("\\t");
+		else
+			port.put(c);
+	}
+	port.put('"');
+}
+
+void OutputPort::print(const Object& ob, bool write_mode)
+{
+	char number[NUMBER_CHARS_MAX];	/* Used to print integer and real */
+	switch (ob.get_type()) {
+	case UNASSIGNED:
+		put("*Unspecified return value*");
+		break;
+	case INTEGER:
+	case REAL:
+		put(number, write_number(number, ob) - number);
+		break;
+	case BOOLEAN:
+		put(ob.get_boolean() ? "#t" : "#f");
+		break;
+	case STRING:
+		if (write_mode)
+			write_string(*this, ob.get_string());
+		else
+			put(ob.get_string());
+		break;
+	case SYMBOL:
+	case KEYWORD:
+		put(ob.get_string());
+		break;
+	case PROCEDURE:
+		if (ob.get_proc()->get_type() == PRIMITIVE)
+			put("<primitive procedure: ");
+		else if (ob.get_proc()->get_type() == COMPOUND)
+			put("<compound procedure: ");
+		else
+			error_handler("ERROR(scheme): unknown procedure -- display");
+		put(ob.get_proc()->get_proc_name());
+		put('>');
+		break;
+	case CONS: {
+		/* (list 1 2 3) print (1 2 3), (cons 1 2) print (1 . 2) */
+		put('(');
+		print(ob.get_cons()->car(), write_mode);
+		Object rest = ob.get_cons()->cdr();
+		for (; rest.get_type() == CONS; rest = rest.get_cons()->cdr()) {
+			put(' ');
+			print(rest.get_cons()->car(), write_mode);
+		}
+		if (rest.get_type() != NIL) {
+			put(" . ");
+			print(rest, write_mode);
+		}
+		put(')');
+		break;
+	}
+	case NIL:
+		put("()");
+		break;
+	case CHAR:
+		if (write_mode)
+			put(char_name(ob.get_string()[0]));
+		else
+			put(ob.get_string());
+		break;
+	case PORT:
+		put(ob.get_port()->is_input() ? "<input port>" : "<output port>");
+		break;
+	case EOF_OBJECT:
+		put("<eof>");
+		break;
+	case THREAD:
+		put("<thread>");
+		break;
+	case CHANNEL:
+		put("<channel>");
+		break;
+	default:
+		error_handler("ERROR(scheme): unknown type -- display");
+	}
+}
+
+/* Print s as a JSON string */
+void put_json_string(OutputPort& port, const string& s)
+{
+	port.put('"');
+	for (char c : s) {
+		if (c == '"' || c == '\\')
+			port.put('\\');
+		if (static_cast<unsigned char>(c) < 0x20) {
+			char escape[8];
+			port.put(escape, snprintf(escape, sizeof(escape), "\\u%04x", c));
+		}
+		else
+			port.put(c);
+	}
+	port.put('"');
+}
+
+/* The port of standard output, display and newline write to it. */
+OutputPort& standard_output_port()
+{
+	static OutputPort port(cout);
+	return port;
+}
+
+void InputPort::close()
+{
+	in = nullptr;
+	owner.reset();
+	tokens.clear();
+	pos = 0;
+}
+
+int InputPort::read_char()
+{
+	if (in == nullptr)
+		error_handler("ERROR(scheme): the input port has been closed");
+	return in->rdbuf()->sbumpc();
+}
+
+int InputPort::peek_char()
+{
+	if (in == nullptr)
+		error_handler("ERROR(scheme): the input port has been closed");
+	return in->rdbuf()->sgetc();
+}
+
+bool InputPort::read_line(string& line)
+{
+	if (in == nullptr)
+		error_handler("ERROR(scheme): the input port has been closed");
+	return static_cast<bool>(getline(*in, line));
+}
+
+bool InputPort::read(Object& datum)
+{
+	if (in == nullptr)
+		error_handler("ERROR(scheme): the input port has been closed");
+	/* Read next expression when all data of the last one have been read */
+	while (pos >= tokens.size()) {
+		if (!in->good())
+			return false;
+		tokens = split_input(get_input(*in));
+		pos = 0;
+	}
+	datum = read_datum(tokens, pos);
+	return true;
+}
+
+/* The port of standard input */
+InputPort& standard_input_port()
+{
+	static InputPort port(cin);
+	return port;
+}
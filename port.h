@@ -0,0 +1,135 @@
+/* Header file of input and output ports */
+
+#ifndef PORT_H_
+#define PORT_H_
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+using namespace std;
+
+#include "object.h"
+
+/* Port: source or destination of characters, such as file, string,
+ * std::cin and std::cout. A port may own its stream(file and string port),
+ * the stream is released when the port is closed.
+ */
+class Port {
+public:
+	virtual ~Port() {}
+
+	/* Return true if it's an input port, false if it's an output port */
+	virtual bool is_input() const = 0;
+	/* Return true if the port hasn't been closed */
+	virtual bool is_open() const = 0;
+	/* Close port, release the stream */
+	virtual void close() = 0;
+
+	/* Lock of port, used when threads share a port */
+	mutex& get_lock() { return lock; }
+private:
+	mutex lock;
+};
+
+/* Output port:
+ * characters are stored in an internal buffer and written to the stream
+ * only when the buffer is full or the port is flushed, so printing a line
+ * doesn't flush the stream like "endl" does.
+ */
+class OutputPort : public Port {
+public:
+	/* Constructor, os is owned by others, such as std::cout */
+	explicit OutputPort(ostream& os) : out(&os), count(0) {}
+	/* Constructor, os is owned by the port, such as file and string */
+	explicit OutputPort(unique_ptr<ostream> os) :
+		out(os.get()), owner(std::move(os)), count(0) {}
+	OutputPort(const OutputPort&) = delete;
+	OutputPort& operator=(const OutputPort&) = delete;
+
+	/* Destructor, write the rest of buffer to the stream */
+	~OutputPort() { close(); }
+
+	bool is_input() const override { return false; }
+	bool is_open() const override { return out != nullptr; }
+	void close() override;
+
+	/* Put characters into buffer */
+	void put(char c) {
+		if (count == BUFFER_SIZE)
+			write_buffer();
+		buffer[count++] = c;
+	}
+	void put(const char* s, size_t n);
+	void put(const char* s);
+	void put(const string& s) { put(s.data(), s.size()); }
+
+	/* Print ob in the form of "display" or "write":
+	 * display: "abc" --> abc, write: "abc" --> "abc".
+	 */
+	void print(const Object& ob, bool write_mode = false);
+
+	/* Write buffer to the stream and flush the stream */
+	void flush();
+
+	/* Return the stream of port, nullptr if the port has been closed */
+	ostream* get_stream() const { return out; }
+
+private:
+	/* Write buffer to the stream, but don't flush the stream */
+	void write_buffer();
+
+	static const size_t BUFFER_SIZE = 1 << 14;
+
+	ostream*			out;		/* Destination of output */
+	unique_ptr<ostream>	owner;		/* Used to release file or string */
+	char				buffer[BUFFER_SIZE];
+	size_t				count;		/* Number of characters in buffer */
+};
+
+/* Input port:
+ * read characters, lines and data from the buffer of stream.
+ */
+class InputPort : public Port {
+public:
+	/* Constructor, is is owned by others, such as std::cin */
+	explicit InputPort(istream& is) : in(&is), pos(0) {}
+	/* Constructor, is is owned by the port, such as file and string */
+	explicit InputPort(unique_ptr<istream> is) :
+		in(is.get()), owner(std::move(is)), pos(0) {}
+	InputPort(const InputPort&) = delete;
+	InputPort& operator=(const InputPort&) = delete;
+
+	bool is_input() const override { return true; }
+	bool is_open() const override { return in != nullptr; }
+	void close() override;
+
+	/* Read a character, return EOF at end of file */
+	int read_char();
+	/* Return next character without moving, return EOF at end of file */
+	int peek_char();
+	/* Read a line without '\n', return false at end of file */
+	bool read_line(string& line);
+	/* Read a datum, such as "(1 2 3)", return false at end of file */
+	bool read(Object& datum);
+
+private:
+	istream*			in;			/* Source of input */
+	unique_ptr<istream>	owner;		/* Used to release file or string */
+
+	/* An input line may contain several data, keep the rest of them. */
+	vector<string>		tokens;
+	size_t				pos;		/* Position of the next datum in tokens */
+};
+
+/* Print s as a JSON string, such as a"b --> "a\"b" */
+void put_json_string(OutputPort& port, const string& s);
+
+/* The port of standard output, display and newline write to it. */
+OutputPort& standard_output_port();
+
+/* The port of standard input */
+InputPort& standard_input_port();
+
+#endif
@@ -2,24 +2,28 @@
 
 #include "primitive_procedures.h"
 #include "eval.h"
+#include "port.h"
+#include "thread_pool.h"
+#include "scheme_thread.h"
 
 /* Quit */
-Object Primitive::quit(vector<Object>& obs)
+Object Primitive::quit(const vector<Object>&)
 {
+	current_interpreter().output_port->flush();
 	cout << "Bye! Press any key to quit." << endl;
 	char input = getchar();
 	exit(0);
 }
 
 /* Reset Evaluator, initialize environment */
-Object Primitive::reset(vector<Object>& obs)
+Object Primitive::reset(const vector<Object>&)
 {
 	reset_evaluator();
 	return Object();
 }
 
 /* Return #t(true) if object is a number */
-Object Primitive::is_number(vector<Object>& obs)
+Object Primitive::is_number(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- number?");
@@ -29,7 +33,7 @@ Object Primitive::is_number(vector<Object>& obs)
 }
 
 /* Return #t(true) if object is a boolean */
-Object Primitive::is_boolean(vector<Object>& obs)
+Object Primitive::is_boolean(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- boolean?");
@@ -39,7 +43,7 @@ Object Primitive::is_boolean(vector<Object>& obs)
 }
 
 /* Return #t(true) if object is a integer */
-Object Primitive::is_integer(vector<Object>& obs)
+Object Primitive::is_integer(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- integer?");
@@ -49,7 +53,7 @@ Object Primitive::is_integer(vector<Object>& obs)
 }
 
 /* Return #t(true) if object is a real */
-Object Primitive::is_real(vector<Object>& obs)
+Object Primitive::is_real(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- real?");
@@ -59,7 +63,7 @@ Object Primitive::is_real(vector<Object>& obs)
 }
 
 /* Return #t(true) if object is a even integer */
-Object Primitive::is_even(vector<Object>& obs)
+Object Primitive::is_even(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- even?");
@@ -71,7 +75,7 @@ Object Primitive::is_even(vector<Object>& obs)
 }
 
 /* Return #t(true) if object is a odd integer */
-Object Primitive::is_odd(vector<Object>& obs)
+Object Primitive::is_odd(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- odd?");
@@ -84,7 +88,7 @@ Object Primitive::is_odd(vector<Object>& obs)
 }
 
 /* Return #t(true) if object is a pair(or list) */
-Object Primitive::is_pair(vector<Object>& obs)
+Object Primitive::is_pair(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- pair?");
@@ -98,7 +102,7 @@ Object Primitive::is_pair(vector<Object>& obs)
 }
 
 /* Return #t(true) if object is a empty list */
-Object Primitive::is_null(vector<Object>& obs)
+Object Primitive::is_null(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- null?");
@@ -107,7 +111,7 @@ Object Primitive::is_null(vector<Object>& obs)
 }
 
 /* Return #t(true) if object is a list */
-Object Primitive::is_list(vector<Object>& obs)
+Object Primitive::is_list(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(schem): requires exactly 1 argument -- list?");
@@ -121,7 +125,7 @@ Object Primitive::is_list(vector<Object>& obs)
 }
 
 /* Return the sum of obs. */
-Object Primitive::add(vector<Object>& obs)
+Object Primitive::add(const vector<Object>& obs)
 {
 	int64_t sum_i = 0;
 	double sum_f = 0.0;
@@ -146,14 +150,14 @@ Object Primitive::add(vector<Object>& obs)
 }
 
 /* Return the difference of obs */
-Object Primitive::sub(vector<Object>& obs)
+Object Primitive::sub(const vector<Object>& obs)
 {
 	if (obs.empty()) return Object(0);
 
 	int diff_i = (obs[0].get_type() == INTEGER ? obs[0].get_integer() : 0);
 	double diff_f = (obs[0].get_type() == REAL ? obs[0].get_real() : 0.0);
 	for (int i = 1; i < obs.size(); i++) {
-		Object &ob = obs[i];
+		const Object &ob = obs[i];
 		if (ob.get_type() == INTEGER)
 			diff_i -= ob.get_integer();
 		else if (ob.get_type() == REAL)
@@ -171,7 +175,7 @@ Object Primitive::sub(vector<Object>& obs)
 }
 
 /* Return the product of obs */
-Object Primitive::mul(vector<Object>& obs)
+Object Primitive::mul(const vector<Object>& obs)
 {
 	int64_t pro_i = 1;
 	double pro_f = 1.0;
@@ -196,7 +200,7 @@ Object Primitive::mul(vector<Object>& obs)
 }
 
 /* Return the quotient of obs */
-Object Primitive::div(vector<Object>& obs)
+Object Primitive::div(const vector<Object>& obs)
 {
 	if (obs.empty()) return Object(0);
 
@@ -204,7 +208,7 @@ Object Primitive::div(vector<Object>& obs)
 		static_cast<double>(obs[0].get_integer()));
 
 	for (int i = 1; i < obs.size(); i++) {
-		Object &ob = obs[i];
+		const Object &ob = obs[i];
 		if (ob.get_type() == INTEGER) {
 			if (ob.get_integer() == 0)
 				error_handler("ERROR(scheme): division by zero");
@@ -226,7 +230,7 @@ Object Primitive::div(vector<Object>& obs)
 }
 
 /* Return remainder */
-Object Primitive::remainder(vector<Object>& obs) 
+Object Primitive::remainder(const vector<Object>& obs) 
 {
 	if (obs.size() != 2) {
 		error_handler("ERROR(scheme): requires exactly 2 arguments -- remainder");
@@ -245,7 +249,7 @@ Object Primitive::remainder(vector<Object>& obs)
 }
 
 /* Return quotient */
-Object Primitive::quotient(vector<Object>& obs)
+Object Primitive::quotient(const vector<Object>& obs)
 {
 	if (obs.size() != 2) {
 		error_handler("ERROR(scheme): requires exactly 2 arguments -- quotient");
@@ -259,7 +263,7 @@ Object Primitive::quotient(vector<Object>& obs)
 }
 
 /* Return absolute value */
-Object Primitive::abs(vector<Object>& obs)
+Object Primitive::abs(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- abs");
@@ -273,7 +277,7 @@ Object Primitive::abs(vector<Object>& obs)
 }
 
 /* Return the square of object */
-Object Primitive::square(vector<Object>& obs)
+Object Primitive::square(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- square");
@@ -284,7 +288,7 @@ Object Primitive::square(vector<Object>& obs)
 }
 
 /* Return the sqrt of object */
-Object Primitive::sqrt(vector<Object>& obs)
+Object Primitive::sqrt(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- sqrt");
@@ -303,7 +307,7 @@ Object Primitive::sqrt(vector<Object>& obs)
 
 
 /* Return the true if obs[0] < obs[1] < obs[2] < ... < obs[n] */
-Object Primitive::less(vector<Object>& obs)
+Object Primitive::less(const vector<Object>& obs)
 {
 	bool result = true;
 	for (int i = 0; i < obs.size() - 1; i++) {
@@ -313,7 +317,7 @@ Object Primitive::less(vector<Object>& obs)
 }
 
 /* Return the true if obs[0] > obs[1] > obs[2] > ... > obs[n] */
-Object Primitive::greater(vector<Object>& obs)
+Object Primitive::greater(const vector<Object>& obs)
 {
 	bool result = true;
 	for (int i = 0; i < obs.size() - 1; i++) {
@@ -324,7 +328,7 @@ Object Primitive::greater(vector<Object>& obs)
 
 /* Return true if obs[0] == obs[1] == obs[2] == ... == obs[n] */
 /* arguments must be numbers */
-Object Primitive::op_equal(vector<Object>& obs) {
+Object Primitive::op_equal(const vector<Object>& obs) {
 	if (obs.size() < 2) {
 		error_handler("ERROR(scheme): = takes at least two arguments");
 	}
@@ -337,7 +341,7 @@ Object Primitive::op_equal(vector<Object>& obs) {
 }
 
 /* Return true if obs[0] >= obs[1] >= obs[2] >= ... >= obs[n] */
-Object Primitive::greaterEqual(vector<Object>& obs)
+Object Primitive::greaterEqual(const vector<Object>& obs)
 {
 	if (obs.size() < 2) {
 		error_handler("ERROR(scheme): >= takes at least two arguments");
@@ -352,7 +356,7 @@ Object Primitive::greaterEqual(vector<Object>& obs)
 }
 
 /* Return true if obs[0] <= obs[1] <= obs[2] <= ... <= obs[n] */
-Object Primitive::lessEqual(vector<Object>& obs)
+Object Primitive::lessEqual(const vector<Object>& obs)
 {
 	if (obs.size() < 2) {
 		error_handler("ERROR(scheme): <= takes at least two arguments");
@@ -368,7 +372,7 @@ Object Primitive::lessEqual(vector<Object>& obs)
 
 
 /* Return the minimum object of obs */
-Object Primitive::min(vector<Object>& obs)
+Object Primitive::min(const vector<Object>& obs)
 {
 	if (obs.empty())
 		error_handler("ERROR(scheme): min requires at least 1 argument");
@@ -383,7 +387,7 @@ Object Primitive::min(vector<Object>& obs)
 }
 
 /* Return the maximum object of obs */
-Object Primitive::max(vector<Object>& obs)
+Object Primitive::max(const vector<Object>& obs)
 {
 	if (obs.empty())
 		error_handler("ERROR(scheme): min requires at least 1 argument");
@@ -398,7 +402,7 @@ Object Primitive::max(vector<Object>& obs)
 }
 
 /* Return true if obs[0] equal obs[1] equal obs[2] equal .. equal obs[n]*/
-Object Primitive::equal(vector<Object>& obs) {
+Object Primitive::equal(const vector<Object>& obs) {
 	if (obs.size() != 2) {
 		error_handler("ERROR(scheme): eq? and eqaul? take two aurgument");
 	}
@@ -411,7 +415,7 @@ Object Primitive::equal(vector<Object>& obs) {
 }
 
 /* Operator! */
-Object Primitive::not(vector<Object>& obs)
+Object Primitive::op_not(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- not");
@@ -422,113 +426,293 @@ Object Primitive::not(vector<Object>& obs)
 		return Object(false);
 }
 
-/* Operator| */
-Object Primitive::or(vector<Object>& obs)
+/* Return the output port of obs[i], return the output port of current
+ * interpreter if there is no obs[i].
+ */
+static OutputPort& get_output_port(const vector<Object>& obs, size_t i,
+	const string& proc_name)
 {
-	if (obs.size() < 2)
-		error_handler("ERROR(scheme): need at least 2 arguments -- or");
+	if (i >= obs.size())
+		return *current_interpreter().output_port;
+	if (obs[i].get_type() != PORT || obs[i].get_port()->is_input())
+		error_handler("ERROR(scheme): requires an output port -- " + proc_name);
+	if (!obs[i].get_port()->is_open())
+		error_handler("ERROR(scheme): the port has been closed -- " + proc_name);
+	return static_cast<OutputPort&>(*obs[i].get_port());
+}
 
-	bool ret = false;
-	for (int i = 0; i < obs.size(); i++)
-		ret |= is_true(obs[i]);
+/* Return the input port of obs[i], return the input port of current
+ * interpreter if there is no obs[i].
+ */
+static InputPort& get_input_port(const vector<Object>& obs, size_t i,
+	const string& proc_name)
+{
+	if (i >= obs.size())
+		return *current_interpreter().input_port;
+	if (obs[i].get_type() != PORT || !obs[i].get_port()->is_input())
+		error_handler("ERROR(scheme): requires an input port -- " + proc_name);
+	if (!obs[i].get_port()->is_open())
+		error_handler("ERROR(scheme): the port has been closed -- " + proc_name);
+	return static_cast<InputPort&>(*obs[i].get_port());
+}
 
-	return Object(ret);
+/* Return the characters of string obs[0], used to get file name and so on */
+static const string& get_string_arg(const vector<Object>& obs,
+	const string& proc_name)
+{
+	if (obs.empty() || obs[0].get_type() != STRING)
+		error_handler("ERROR(scheme): requires a string -- " + proc_name);
+	return obs[0].get_string();
 }
 
-/* Operator& */
-Object Primitive::and (vector<Object>& obs)
+/* Print obs with display or write, the last of obs could be an output port */
+static void print_objects(const vector<Object>& obs, bool write_mode,
+	const string& proc_name)
 {
-	if (obs.size() < 2)
-		error_handler("ERROR(scheme): need at least 2 arguments -- and");
+	int cnt = obs.size();
+	if (cnt >= 2 && obs.back().get_type() == PORT)
+		cnt--;
+	OutputPort& port = get_output_port(obs, cnt, proc_name);
+	lock_guard<mutex> guard(port.get_lock());
+	for (int i = 0; i < cnt; i++) {
+		if (i > 0) port.put(' ');
+		port.print(obs[i], write_mode);
+	}
+}
 
-	bool ret = true;
-	for (int i = 0; i < obs.size(); i++)
-		ret &= is_true(obs[i]);
+/* Print obs, such as (display "abc" 1) --> abc 1 */
+Object Primitive::display(const vector<Object>& obs)
+{
+	print_objects(obs, false, "display");
+	return Object();
+}
 
-	return Object(ret);
+/* Print obs in the form that can be read, such as (write "abc") --> "abc" */
+Object Primitive::write(const vector<Object>& obs)
+{
+	print_objects(obs, true, "write");
+	return Object();
+}
+
+/* New line */
+Object Primitive::newline(const vector<Object>& obs) {
+	OutputPort& port = get_output_port(obs, 0, "newline");
+	lock_guard<mutex> guard(port.get_lock());
+	port.put('\n');
+	return Object();
 }
 
+/* Write the buffered output to the stream of port */
+Object Primitive::flush_output_port(const vector<Object>& obs)
+{
+	OutputPort& port = get_output_port(obs, 0, "flush-output-port");
+	lock_guard<mutex> guard(port.get_lock());
+	port.flush();
+	return Object();
+}
 
+/* Print the characters of string obs[0] */
+Object Primitive::write_string(const vector<Object>& obs)
+{
+	if (obs.empty() || obs[0].get_type() != STRING)
+		error_handler("ERROR(scheme): requires a string -- write-string");
+	OutputPort& port = get_output_port(obs, 1, "write-string");
+	lock_guard<mutex> guard(port.get_lock());
+	port.print(obs[0]);
+	return Object();
+}
 
-/* Print obs */
-Object Primitive::display(vector<Object>& obs)
+/* Print character obs[0] */
+Object Primitive::write_char(const vector<Object>& obs)
 {
-	for (auto &ob : obs) {
-		int type = ob.get_type();
-#if 0
-		cout << "DEBUG display(): type of ob -- "<< ob.get_type_str() << endl;
-#endif
-		string delim = ". ";	/* Used to display dons and list*/
-		int proc_type;			/* Used to display procedure */
-		string proc_name;		/* Used to display procedure */
-		switch (type) {
-		case UNASSIGNED:
-			cerr << "*Unspecified return value*";
-			break;
-		case INTEGER:
-			cout << ob.get_integer() << " ";
-			break;
-		case REAL:
-			cout << ob.get_real() << " ";
-			break;
-		case BOOLEAN:
-			cout << (ob.get_boolean() ? "true" : "false") << " ";
-			break;
-		case STRING:
-			cout << ob.get_string() << " ";
-			break;
-		case PROCEDURE:
-			proc_type = ob.get_proc()->get_type();
-			proc_name = ob.get_proc()->get_proc_name();
-			if (proc_type == PRIMITIVE)
-				cout << "<primitive procedure: " << proc_name << ">";
-			else if (proc_type == COMPOUND)
-				cout << "<compound procedure: " << proc_name << ">";
-			else
-				error_handler("ERROR(scheme): unknown procedure -- display");
-			break;
-		case CONS:
-			if (is_true(is_list(vector<Object>{ob}))) delim = " ";
-			cout << "(";
-			while (ob.get_type() == CONS) {
-				Primitive::display(vector<Object>{ob.get_cons()->car()});
-				cout << delim;
-				ob = ob.get_cons()->cdr();
-			}
-			if (ob.get_type() != NIL)
-				Primitive::display(vector<Object>{ob});
-			else
-				cout << "\b"; // (list 1 2 3) print(1 2 3), instead of(1 2 3).
-			/* Backspace, (cons 1 2) print (1 . 2), instead of (1 . 2 ) */
-			cout << "\b) ";
-			break;
-		case NIL:
-			cout << "'()";
-			break;
-#ifdef USE_LIST
-		case LIST:
-			cout << "(";
-			for (auto &ob : ob.get_list()->lst)
-				Primitive::display(vector<Object>{ob});
-			/* Backspace, (list 1 2 3) print (1 2 3), instead of (1 2 3 ) */
-			cout << "\b) ";
-			break;
-#endif
-		default: 
-			error_handler("ERROR(scheme): unknown type -- display");
-		}
-	}
+	if (obs.empty() || obs[0].get_type() != CHAR)
+		error_handler("ERROR(scheme): requires a character -- write-char");
+	OutputPort& port = get_output_port(obs, 1, "write-char");
+	lock_guard<mutex> guard(port.get_lock());
+	port.put(obs[0].get_string()[0]);
 	return Object();
 }
 
-/* New line */
-Object Primitive::newline(vector<Object>& obs) {
-	cout << endl;
+/* Open a file for input, (open-input-file "path/name") */
+Object Primitive::open_input_file(const vector<Object>& obs)
+{
+	string filename = get_string_arg(obs, "open-input-file");
+	unique_ptr<istream> file(new ifstream(filename, ifstream::in));
+	if (!*file)
+		error_handler("ERROR(scheme): can't open this file -- " + filename);
+	return Object(shared_ptr<Port>(new InputPort(std::move(file))));
+}
+
+/* Open a file for output, (open-output-file "path/name") */
+Object Primitive::open_output_file(const vector<Object>& obs)
+{
+	string filename = get_string_arg(obs, "open-output-file");
+	unique_ptr<ostream> file(new ofstream(filename, ofstream::out));
+	if (!*file)
+		error_handler("ERROR(scheme): can't open this file -- " + filename);
+	return Object(shared_ptr<Port>(new OutputPort(std::move(file))));
+}
+
+/* Return an input port which reads characters from string obs[0] */
+Object Primitive::open_input_string(const vector<Object>& obs)
+{
+	string chars = get_string_arg(obs, "open-input-string");
+	unique_ptr<istream> iss(new istringstream(chars));
+	return Object(shared_ptr<Port>(new InputPort(std::move(iss))));
+}
+
+/* Return an output port which accumulates characters */
+Object Primitive::open_output_string(const vector<Object>&)
+{
+	unique_ptr<ostream> oss(new ostringstream());
+	return Object(shared_ptr<Port>(new OutputPort(std::move(oss))));
+}
+
+/* Return the characters accumulated in a port of open-output-string */
+Object Primitive::get_output_string(const vector<Object>& obs)
+{
+	if (obs.size() != 1)
+		error_handler("ERROR(scheme): requires exactly 1 argument "
+			"-- get-output-string");
+	OutputPort& port = get_output_port(obs, 0, "get-output-string");
+	ostringstream* oss = dynamic_cast<ostringstream*>(port.get_stream());
+	if (oss == nullptr)
+		error_handler("ERROR(scheme): requires a string port "
+			"-- get-output-string");
+	lock_guard<mutex> guard(port.get_lock());
+	port.flush();
+	return Object(oss->str());
+}
+
+/* Close a port, (close-port port) */
+Object Primitive::close_port(const vector<Object>& obs)
+{
+	if (obs.size() != 1 || obs[0].get_type() != PORT)
+		error_handler("ERROR(scheme): requires a port -- close-port");
+	obs[0].get_port()->close();
 	return Object();
 }
 
+/* Read a line, return an eof object at end of file */
+Object Primitive::read_line(const vector<Object>& obs)
+{
+	string line;
+	InputPort& port = get_input_port(obs, 0, "read-line");
+	lock_guard<mutex> guard(port.get_lock());
+	if (!port.read_line(line))
+		return Object("eof", EOF_OBJECT);
+	return Object(std::move(line));
+}
+
+/* Read a character, return an eof object at end of file */
+Object Primitive::read_char(const vector<Object>& obs)
+{
+	InputPort& port = get_input_port(obs, 0, "read-char");
+	lock_guard<mutex> guard(port.get_lock());
+	int c = port.read_char();
+	if (c == EOF)
+		return Object("eof", EOF_OBJECT);
+	return Object(string(1, static_cast<char>(c)), CHAR);
+}
+
+/* Return the next character without moving to the next one */
+Object Primitive::peek_char(const vector<Object>& obs)
+{
+	InputPort& port = get_input_port(obs, 0, "peek-char");
+	lock_guard<mutex> guard(port.get_lock());
+	int c = port.peek_char();
+	if (c == EOF)
+		return Object("eof", EOF_OBJECT);
+	return Object(string(1, static_cast<char>(c)), CHAR);
+}
+
+/* Read a datum, such as (1 "abc" (2 3)) */
+Object Primitive::read(const vector<Object>& obs)
+{
+	Object datum;
+	InputPort& port = get_input_port(obs, 0, "read");
+	lock_guard<mutex> guard(port.get_lock());
+	if (!port.read(datum))
+		return Object("eof", EOF_OBJECT);
+	return datum;
+}
+
+/* Return an eof object */
+Object Primitive::eof_object(const vector<Object>&)
+{
+	return Object("eof", EOF_OBJECT);
+}
+
+/* Return #t(true) if object is an eof object */
+Object Primitive::is_eof_object(const vector<Object>& obs)
+{
+	if (obs.size() != 1)
+		error_handler("ERROR(scheme): requires exactly 1 argument -- eof-object?");
+
+	return Object(obs[0].get_type() == EOF_OBJECT);
+}
+
+/* Return #t(true) if object is an input port */
+Object Primitive::is_input_port(const vector<Object>& obs)
+{
+	if (obs.size() != 1)
+		error_handler("ERROR(scheme): requires exactly 1 argument -- input-port?");
+
+	return Object(obs[0].get_type() == PORT && obs[0].get_port()->is_input());
+}
+
+/* Return #t(true) if object is an output port */
+Object Primitive::is_output_port(const vector<Object>& obs)
+{
+	if (obs.size() != 1)
+		error_handler("ERROR(scheme): requires exactly 1 argument "
+			"-- output-port?");
+
+	return Object(obs[0].get_type() == PORT && !obs[0].get_port()->is_input());
+}
+
+/* Return the input port of current interpreter */
+Object Primitive::current_input_port(const vector<Object>&)
+{
+	return Object(shared_ptr<Port>(current_interpreter().input_port));
+}
+
+/* Return the output port of current interpreter */
+Object Primitive::current_output_port(const vector<Object>&)
+{
+	return Object(shared_ptr<Port>(current_interpreter().output_port));
+}
+
+/* (call-with-output-file "path/name" proc): open the file, call proc with
+ * the port, close the port and return the value of proc.
+ */
+Object Primitive::call_with_output_file(const vector<Object>& obs)
+{
+	if (obs.size() != 2)
+		error_handler("ERROR(scheme): requires exactly 2 arguments "
+			"-- call-with-output-file");
+	Object port = open_output_file(vector<Object>{ obs[0] });
+	Object result = apply_proc(obs[1], vector<Object>{ port });
+	port.get_port()->close();
+	return result;
+}
+
+/* (call-with-input-file "path/name" proc): open the file, call proc with
+ * the port, close the port and return the value of proc.
+ */
+Object Primitive::call_with_input_file(const vector<Object>& obs)
+{
+	if (obs.size() != 2)
+		error_handler("ERROR(scheme): requires exactly 2 arguments "
+			"-- call-with-input-file");
+	Object port = open_input_file(vector<Object>{ obs[0] });
+	Object result = apply_proc(obs[1], vector<Object>{ port });
+	port.get_port()->close();
+	return result;
+}
+
 /* Load code from file and evaluate */
-Object Primitive::load(vector<Object>& obs)
+Object Primitive::load(const vector<Object>& obs)
 {
 	if (obs.empty())
 		error_handler(string("ERROR(scheme): need a file name -- load\n") +
@@ -538,39 +722,46 @@ Object Primitive::load(vector<Object>& obs)
 			+ "Usage: load \"path/name\" ");
 	}
 
-	string filename = obs[0].get_string();
-	ifstream ifile(filename.substr(1, filename.size() - 2), ifstream::in);
+	const string& filename = obs[0].get_string();
+	ifstream ifile(filename, ifstream::in);
 	if (!ifile) {
-		error_handler(string("ERROR(scheme): can't open this file -- ") +
-			obs[0].get_string());
+		error_handler(string("ERROR(scheme): can't open this file -- \"") +
+			filename + "\"");
 	}
 
-	static int tab = 0; /* Used to print loading information. */
+	/* Depth of nested load, used to print loading information. */
+	int& tab = current_interpreter().load_depth;
 
-	if (tab == 0) cout << ">>> ";
-	cout << string((tab++) * 4, ' ') << "Loading " 
-		 << filename.substr(1, filename.size() - 2) << endl;
+	OutputPort& port = *current_interpreter().output_port;
+	if (tab == 0) port.put(">>> ");
+	port.put(string((tab++) * 4, ' ') + "Loading " + filename + "\n");
 
+	try {
 #if 1
-	run_evaluator(ifile, 1);
+		run_evaluator(ifile, 1);
 #else
-	run_evaluator(ifile, 2);
+		run_evaluator(ifile, 2);
 #endif
+	}
+	catch (...) {	/* Errors and escapes of continuations */
+		tab = 0;
+		throw;
+	}
 
 	if (--tab == 0)
-		cout << ">>> Loading completed!" << endl << endl;
+		port.put(">>> Loading completed!\n\n");
 	return Object();
 }
 
 
 /* Return the pair of obs as an Object */
-Object Primitive::make_cons(vector<Object>& obs)
+Object Primitive::make_cons(const vector<Object>& obs)
 {
 	return Object(Cons(obs));
 }
 
 /* Return the list of obs as an Object */
-Object Primitive::make_list(vector<Object>& obs)
+Object Primitive::make_list(const vector<Object>& obs)
 {
 	Object ret("nil", NIL);
 	for (int i = obs.size() - 1; i >= 0; i--)
@@ -580,7 +771,7 @@ Object Primitive::make_list(vector<Object>& obs)
 }
 
 /* Return the car of object */
-Object Primitive::car(vector<Object>& obs)
+Object Primitive::car(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- car");
@@ -593,7 +784,7 @@ Object Primitive::car(vector<Object>& obs)
 }
 
 /* Return the cdr of object */
-Object Primitive::cdr(vector<Object>& obs)
+Object Primitive::cdr(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- cdr");
@@ -606,7 +797,7 @@ Object Primitive::cdr(vector<Object>& obs)
 }
 
 /* Return the caar of object */
-Object Primitive::caar(vector<Object>& obs)
+Object Primitive::caar(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- caar");
@@ -619,7 +810,7 @@ Object Primitive::caar(vector<Object>& obs)
 }
 
 /* Return the cadr of object */
-Object Primitive::cadr(vector<Object>& obs)
+Object Primitive::cadr(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- cadr");
@@ -632,7 +823,7 @@ Object Primitive::cadr(vector<Object>& obs)
 }
 
 /* Return the cdar of object */
-Object Primitive::cdar(vector<Object>& obs)
+Object Primitive::cdar(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- cdar");
@@ -645,7 +836,7 @@ Object Primitive::cdar(vector<Object>& obs)
 }
 
 /* Return the cddr of object */
-Object Primitive::cddr(vector<Object>& obs)
+Object Primitive::cddr(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- cddr");
@@ -658,7 +849,7 @@ Object Primitive::cddr(vector<Object>& obs)
 }
 
 /* Append objects or lists to obs[0] */
-Object Primitive::append(vector<Object>& obs)
+Object Primitive::append(const vector<Object>& obs)
 {
 	if (obs.size() != 2)
 		error_handler("ERROR(scheme): requires exactly 2 argument -- append");
@@ -673,7 +864,7 @@ Object Primitive::append(vector<Object>& obs)
 }
 
 /* Return length of obs[0] */
-Object Primitive::length(vector<Object>& obs)
+Object Primitive::length(const vector<Object>& obs)
 {
 	if (obs.size() != 1)
 		error_handler("ERROR(scheme): requires exactly 1 argument -- length");
@@ -689,8 +880,414 @@ Object Primitive::length(vector<Object>& obs)
 	return Object(ret);
 }
 
+/* scheme: list-ref */
+Object Primitive::list_ref(const vector<Object>& obs)
+{
+	if (obs.size() != 2)
+		error_handler("ERROR(scheme): requires exactly 2 arguments -- list-ref");
+	if (obs[1].get_type() != INTEGER || obs[1].get_integer() < 0)
+		error_handler("ERROR(scheme): passed a " + obs[1].get_type_str() +
+			" to list-ref, it requires a non-negative integer index.");
+	const Object* ob = &obs[0];
+	for (int k = obs[1].get_integer(); ob->get_type() == CONS; k--) {
+		if (k == 0)
+			return ob->get_cons()->car();
+		ob = &ob->get_cons()->cdr();
+	}
+	error_handler("ERROR(scheme): index " + to_string(obs[1].get_integer()) +
+		" is out of range -- list-ref");
+	return Object();
+}
+
+/* Search list obs[1] for obs[0], key gets the object compared with obs[0]
+ * from an element, same compares them unless obs[2] is given; return the
+ * first tail whose element matches.
+ */
+template <typename Key, typename Same>
+static Object search_list(const vector<Object>& obs, Key key, Same same,
+	const char* proc_name)
+{
+	if (obs.size() != 2 && obs.size() != 3)
+		error_handler(string("ERROR(scheme): requires 2 or 3 arguments -- ") +
+			proc_name);
+	if (obs.size() == 3 && obs[2].get_type() != PROCEDURE)
+		error_handler(string("ERROR(scheme): passed a ") +
+			obs[2].get_type_str() + " to " + proc_name +
+			", it requires a procedure to compare.");
+	vector<Object> args(2);
+	args[0] = obs[0];
+	const Object* ob = &obs[1];
+	for (; ob->get_type() == CONS; ob = &ob->get_cons()->cdr()) {
+		const Object& item = key(ob->get_cons()->car());
+		if (obs.size() == 2 ? same(obs[0], item) :
+			(args[1] = item, is_true(apply_proc(obs[2], args))))
+			return *ob;
+	}
+	if (ob->get_type() != NIL)
+		error_handler(string("ERROR(scheme): passed a ") +
+			obs[1].get_type_str() + " to " + proc_name + ", it requires a list.");
+	return Object(false);
+}
+
+/* Compare by equal? */
+static bool is_equal(const Object& a, const Object& b)
+{
+	return a == b;
+}
+
+/* Compare by identity: pairs, procedures and strings are the same object,
+ * other objects are compared by value.
+ */
+static bool is_identical(const Object& a, const Object& b)
+{
+	if (a.get_type() == STRING && b.get_type() == STRING)
+		return &a.get_string() == &b.get_string();
+	return a == b;
+}
+
+/* scheme: member */
+Object Primitive::member(const vector<Object>& obs)
+{
+	return search_list(obs, [](const Object& item) -> const Object& {
+		return item; }, is_equal, "member");
+}
+
+/* Return the key of a pair of association list */
+static const Object& association_key(const Object& item)
+{
+	if (item.get_type() != CONS)
+		error_handler("ERROR(scheme): passed a " + item.get_type_str() +
+			" as an element of association list, it requires a pair.");
+	return item.get_cons()->car();
+}
+
+/* scheme: assoc */
+Object Primitive::assoc(const vector<Object>& obs)
+{
+	Object tail = search_list(obs, association_key, is_equal, "assoc");
+	return tail.get_type() == CONS ? tail.get_cons()->car() : tail;
+}
+
+/* scheme: assq */
+Object Primitive::assq(const vector<Object>& obs)
+{
+	if (obs.size() != 2)
+		error_handler("ERROR(scheme): requires exactly 2 arguments -- assq");
+	Object tail = search_list(obs, association_key, is_identical, "assq");
+	return tail.get_type() == CONS ? tail.get_cons()->car() : tail;
+}
+
+/* Stable merge sort of items[first, last), buffer has the size of items.
+ * A comparator which is inconsistent, such as a random one, gets some
+ * order of the items instead of undefined behavior.
+ */
+template <typename Less>
+static void merge_sort(vector<Object>& items, vector<Object>& buffer,
+	size_t first, size_t last, Less& less)
+{
+	if (last - first < 2)
+		return;
+	size_t middle = first + (last - first) / 2;
+	merge_sort(items, buffer, first, middle, less);
+	merge_sort(items, buffer, middle, last, less);
+	if (!less(items[middle], items[middle - 1]))	/* Already in order */
+		return;
+	size_t i = first, j = middle, k = first;
+	while (i < middle && j < last)
+		buffer[k++] = std::move(less(items[j], items[i]) ? items[j++] : items[i++]);
+	while (i < middle)
+		buffer[k++] = std::move(items[i++]);
+	while (j < last)
+		buffer[k++] = std::move(items[j++]);
+	std::move(buffer.begin() + first, buffer.begin() + last,
+		items.begin() + first);
+}
+
+/* Return the value of a number as double */
+static inline double number_value(const Object& ob)
+{
+	return ob.get_type() == INTEGER ? ob.get_integer() : ob.get_real();
+}
+
+/* Sort the elements of list into a new list, less is a procedure object */
+static Object sort_list(const Object& list, const Object& less,
+	const char* proc_name)
+{
+	if (less.get_type() != PROCEDURE)
+		error_handler(string("ERROR(scheme): passed a ") +
+			less.get_type_str() + " to " + proc_name +
+			", it requires a procedure to compare.");
+	vector<Object> items;
+	const Object* ob = &list;
+	for (; ob->get_type() == CONS; ob = &ob->get_cons()->cdr())
+		items.push_back(ob->get_cons()->car());
+	if (ob->get_type() != NIL)
+		error_handler(string("ERROR(scheme): passed a ") +
+			list.get_type_str() + " to " + proc_name + ", it requires a list.");
+
+	/* < and > on numbers are compared directly, other procedures are
+	 * called with a vector of arguments reused by all comparisons.
+	 */
+	using PrimitivePtr = Object(*)(const vector<Object>&);
+	const Procedure& proc = *less.get_proc();
+	const PrimitivePtr* func = proc.get_type() == PRIMITIVE ?
+		proc.get_primitive().target<PrimitivePtr>() : nullptr;
+	bool numbers = all_of(items.begin(), items.end(),
+		[](const Object& item) { return item.is_number(); });
+	vector<Object> buffer(items.size());
+	if (numbers && func != nullptr && *func == Primitive::less) {
+		auto compare = [](const Object& a, const Object& b) {
+			return number_value(a) < number_value(b); };
+		merge_sort(items, buffer, 0, items.size(), compare);
+	}
+	else if (numbers && func != nullptr && *func == Primitive::greater) {
+		auto compare = [](const Object& a, const Object& b) {
+			return number_value(a) > number_value(b); };
+		merge_sort(items, buffer, 0, items.size(), compare);
+	}
+	else {
+		vector<Object> args(2);
+		auto compare = [&](const Object& a, const Object& b) {
+			args[0] = a;
+			args[1] = b;
+			return is_true(apply_proc(less, args));
+		};
+		merge_sort(items, buffer, 0, items.size(), compare);
+	}
+
+	Object ret("nil", NIL);
+	for (size_t i = items.size(); i > 0; i--)
+		ret = Object(Cons(std::move(items[i - 1]), ret));
+	return ret;
+}
+
+/* scheme: sort */
+Object Primitive::sort(const vector<Object>& obs)
+{
+	if (obs.size() != 2)
+		error_handler("ERROR(scheme): requires exactly 2 arguments -- sort");
+	return sort_list(obs[0], obs[1], "sort");
+}
+
+/* scheme: list-sort */
+Object Primitive::list_sort(const vector<Object>& obs)
+{
+	if (obs.size() != 2)
+		error_handler("ERROR(scheme): requires exactly 2 arguments -- list-sort");
+	return sort_list(obs[1], obs[0], "list-sort");
+}
+
+/* Return the characters of string obs[i] */
+static const string& string_operand(const vector<Object>& obs, size_t i,
+	const char* proc_name)
+{
+	if (obs[i].get_type() != STRING)
+		error_handler(string("ERROR(scheme): passed a ") +
+			obs[i].get_type_str() + " to " + proc_name +
+			", it requires a string.");
+	return obs[i].get_string();
+}
+
+/* Return integer obs[i] which is an index of 0..limit */
+static size_t index_operand(const vector<Object>& obs, size_t i, size_t limit,
+	const char* proc_name)
+{
+	if (obs[i].get_type() != INTEGER)
+		error_handler(string("ERROR(scheme): passed a ") +
+			obs[i].get_type_str() + " to " + proc_name +
+			", it requires an integer index.");
+	int k = obs[i].get_integer();
+	if (k < 0 || static_cast<size_t>(k) > limit)
+		error_handler("ERROR(scheme): index " + to_string(k) +
+			" is out of range -- " + proc_name);
+	return k;
+}
+
+/* Return #t(true) if object is a string */
+Object Primitive::is_string(const vector<Object>& obs)
+{
+	if (obs.size() != 1)
+		error_handler("ERROR(scheme): requires exactly 1 argument -- string?");
+	return Object(obs[0].get_type() == STRING);
+}
+
+/* Return the number of characters of a string */
+Object Primitive::string_length(const vector<Object>& obs)
+{
+	if (obs.size() != 1)
+		error_handler("ERROR(scheme): requires exactly 1 argument "
+			"-- string-length");
+	return Object(static_cast<int>(string_operand(obs, 0, "string-length").size()));
+}
+
+/* Return the k-th character of a string */
+Object Primitive::string_ref(const vector<Object>& obs)
+{
+	if (obs.size() != 2)
+		error_handler("ERROR(scheme): requires exactly 2 arguments "
+			"-- string-ref");
+	const string& str = string_operand(obs, 0, "string-ref");
+	size_t k = index_operand(obs, 1, str.size(), "string-ref");
+	if (k == str.size())
+		error_handler("ERROR(scheme): index " + to_string(k) +
+			" is out of range -- string-ref");
+	return Object(string(1, str[k]), CHAR);
+}
+
+/* Return characters start..end-1 of a string */
+Object Primitive::substring(const vector<Object>& obs)
+{
+	if (obs.size() != 2 && obs.size() != 3)
+		error_handler("ERROR(scheme): requires 2 or 3 arguments -- substring");
+	const string& str = string_operand(obs, 0, "substring");
+	size_t start = index_operand(obs, 1, str.size(), "substring");
+	size_t end = obs.size() == 3 ?
+		index_operand(obs, 2, str.size(), "substring") : str.size();
+	if (end < start)
+		error_handler("ERROR(scheme): end is less than start -- substring");
+	return Object(str.substr(start, end - start));
+}
+
+/* Return a string of the characters of all obs, the length of the result is
+ * counted first, so it's allocated once.
+ */
+Object Primitive::string_append(const vector<Object>& obs)
+{
+	size_t size = 0;
+	for (size_t i = 0; i < obs.size(); i++)
+		size += string_operand(obs, i, "string-append").size();
+	string result;
+	result.reserve(size);
+	for (auto &ob : obs)
+		result += ob.get_string();
+	return Object(std::move(result));
+}
+
+/* Compare adjacent strings of obs with compare */
+template <typename Compare>
+static Object compare_strings(const vector<Object>& obs, Compare compare,
+	const char* proc_name)
+{
+	if (obs.size() < 2)
+		error_handler(string("ERROR(scheme): requires at least 2 arguments "
+			"-- ") + proc_name);
+	for (size_t i = 0; i < obs.size(); i++)
+		string_operand(obs, i, proc_name);
+	for (size_t i = 1; i < obs.size(); i++)
+		if (!compare(obs[i - 1].get_string(), obs[i].get_string()))
+			return Object(false);
+	return Object(true);
+}
+
+Object Primitive::string_equal(const vector<Object>& obs)
+{
+	return compare_strings(obs, equal_to<string>(), "string=?");
+}
+
+Object Primitive::string_less(const vector<Object>& obs)
+{
+	return compare_strings(obs, std::less<string>(), "string<?");
+}
+
+/* Return the number of a string, numbers are written as the reader reads
+ * them, such as "-12" and "1.5", see read_number().
+ */
+Object Primitive::string_to_number(const vector<Object>& obs)
+{
+	if (obs.size() != 1)
+		error_handler("ERROR(scheme): requires exactly 1 argument "
+			"-- string->number");
+	const string& str = string_operand(obs, 0, "string->number");
+	Object number;
+	if (!read_number(str.data(), str.data() + str.size(), number))
+		return Object(false);
+	return number;
+}
+
+/* Return the string of a number, in the form printed by display */
+Object Primitive::number_to_string(const vector<Object>& obs)
+{
+	if (obs.size() != 1)
+		error_handler("ERROR(scheme): requires exactly 1 argument "
+			"-- number->string");
+	if (obs[0].get_type() != INTEGER && obs[0].get_type() != REAL)
+		error_handler("ERROR(scheme): passed a " + obs[0].get_type_str() +
+			" to number->string, it only takes integer and real.");
+	char number[NUMBER_CHARS_MAX];
+	return Object(string(number, write_number(number, obs[0])));
+}
+
+/* Return the list of fields of a string */
+Object Primitive::string_split(const vector<Object>& obs)
+{
+	if (obs.size() != 1 && obs.size() != 2)
+		error_handler("ERROR(scheme): requires 1 or 2 arguments -- string-split");
+	const string& str = string_operand(obs, 0, "string-split");
+
+	vector<Object> fields;
+	if (obs.size() == 1) {
+		size_t pos = 0;
+		while (true) {
+			while (pos < str.size() && isspace(static_cast<unsigned char>(str[pos])))
+				pos++;
+			if (pos == str.size())
+				break;
+			size_t end = pos;
+			while (end < str.size() && !isspace(static_cast<unsigned char>(str[end])))
+				end++;
+			fields.push_back(Object(str.substr(pos, end - pos)));
+			pos = end;
+		}
+	}
+	else {
+		if (obs[1].get_type() != CHAR && obs[1].get_type() != STRING)
+			error_handler("ERROR(scheme): passed a " + obs[1].get_type_str() +
+				" to string-split, the separator must be a char or a string.");
+		const string& sep = obs[1].get_string();
+		if (sep.empty())
+			error_handler("ERROR(scheme): the separator is empty -- string-split");
+		size_t pos = 0;
+		for (size_t end; (end = str.find(sep, pos)) != string::npos;
+			pos = end + sep.size())
+			fields.push_back(Object(str.substr(pos, end - pos)));
+		fields.push_back(Object(str.substr(pos)));
+	}
+
+	Object result("nil", NIL);
+	for (size_t i = fields.size(); i-- > 0; )
+		result = Object(Cons(std::move(fields[i]), result));
+	return result;
+}
+
+/* Return the index of the first character from start which is obs[1] or
+ * satisfies predicate obs[1]
+ */
+Object Primitive::string_index(const vector<Object>& obs)
+{
+	if (obs.size() != 2 && obs.size() != 3)
+		error_handler("ERROR(scheme): requires 2 or 3 arguments -- string-index");
+	const string& str = string_operand(obs, 0, "string-index");
+	size_t start = obs.size() == 3 ?
+		index_operand(obs, 2, str.size(), "string-index") : 0;
+
+	if (obs[1].get_type() == CHAR) {
+		size_t pos = str.find(obs[1].get_string()[0], start);
+		return pos == string::npos ? Object(false) : Object(static_cast<int>(pos));
+	}
+	if (obs[1].get_type() != PROCEDURE)
+		error_handler("ERROR(scheme): passed a " + obs[1].get_type_str() +
+			" to string-index, it requires a char or a predicate.");
+	vector<Object> arg(1);
+	for (size_t i = start; i < str.size(); i++) {
+		arg[0] = Object(string(1, str[i]), CHAR);
+		if (is_true(apply_proc(obs[1], arg)))
+			return Object(static_cast<int>(i));
+	}
+	return Object(false);
+}
+
 /* scheme: map */
-Object Primitive::map(vector<Object>& obs)
+Object Primitive::map(const vector<Object>& obs)
 {
 	if (obs.size() != 2)
 		error_handler("ERROR(scheme): requires exactly 2 argument -- map");
@@ -701,19 +1298,37 @@ Object Primitive::map(vector<Object>& obs)
 		error_handler("ERROR(scheme): passed incorrect type augument to map");
 	}
 
-	Object ret = obs[1];
+	/* Build a new list, obs[1] may be a quoted constant shared by others */
+	vector<Object> results;
 	Object ob = obs[1];
 	while (!is_true(is_null(vector<Object>{ ob }))) {
 		auto spt = ob.get_cons();
-		spt->set_car(apply_proc(obs[0], vector<Object>{ spt->car() }));
+		results.push_back(apply_proc(obs[0], vector<Object>{ spt->car() }));
 		ob = spt->cdr();
 	}
 
-	return ret;
+	return make_list(results);
+}
+
+/* scheme: apply, (apply proc arg ... list) calls proc with the args and
+ * the elements of list.
+ */
+Object Primitive::apply(const vector<Object>& obs)
+{
+	if (obs.size() < 2)
+		error_handler("ERROR(scheme): requires at least 2 arguments -- apply");
+	if (obs[0].get_type() != PROCEDURE || !is_true(is_list(vector<Object>{ obs.back() })))
+		error_handler("ERROR(scheme): passed incorrect type augument to apply");
+
+	vector<Object> args(obs.begin() + 1, obs.end() - 1);
+	for (const Object* rest = &obs.back(); rest->get_type() == CONS;
+		rest = &rest->get_cons()->cdr())
+		args.push_back(rest->get_cons()->car());
+	return apply_proc(obs[0], args);
 }
 
 /* scheme: for-each */
-Object Primitive::for_each(vector<Object>& obs)
+Object Primitive::for_each(const vector<Object>& obs)
 {
 	if (obs.size() != 2)
 		error_handler("ERROR(scheme): requires exactly 2 argument -- for-each");
@@ -733,4 +1348,350 @@ Object Primitive::for_each(vector<Object>& obs)
 	}
 
 	return Object();
-}
\ No newline at end of file
+}
+
+/* Apply obs[0] to each element of list obs[1] on the workers of thread
+ * pool, store the results in results if it isn't nullptr.
+ */
+static void parallel_apply(const vector<Object>& obs, vector<Object>* results,
+	const string& proc_name)
+{
+	if (obs.size() != 2)
+		error_handler("ERROR(scheme): requires exactly 2 argument -- " + proc_name);
+	if (obs[0].get_type() != PROCEDURE || !is_true(Primitive::is_list(vector<Object>{ obs[1] })))
+		error_handler("ERROR(scheme): passed incorrect type augument to " +
+			proc_name);
+
+	vector<Object> items;
+	for (Object ob = obs[1]; ob.get_type() == CONS; ob = ob.get_cons()->cdr())
+		items.push_back(ob.get_cons()->car());
+	if (results != nullptr)
+		results->resize(items.size());
+
+	/* Split items into tasks, several tasks per worker to balance load */
+	ThreadPool& pool = ThreadPool::instance();
+	size_t n = items.size();
+	size_t task_cnt = std::min(n, static_cast<size_t>(pool.size()) * 4);
+	if (task_cnt == 0)
+		return;
+
+	/* Workers evaluate in copies of the interpreter of current thread */
+	const Interpreter& parent = current_interpreter();
+	atomic<size_t> remaining(task_cnt);
+	mutex lock;
+	exception_ptr error;
+	for (size_t t = 0; t < task_cnt; t++) {
+		size_t begin = n * t / task_cnt, end = n * (t + 1) / task_cnt;
+		pool.submit([&, begin, end] {
+			try {
+				WorkerState state(parent);
+				vector<Object> args(1);
+				for (size_t i = begin; i < end; i++) {
+					args[0] = items[i];
+					Object result = apply_proc(obs[0], args);
+					if (results != nullptr)
+						(*results)[i] = result;
+				}
+			}
+			catch (...) {
+				lock_guard<mutex> guard(lock);
+				if (!error)
+					error = current_exception();
+			}
+			/* Locals of the caller are gone once remaining is 0 */
+			if (--remaining == 0)
+				ThreadPool::instance().notify_waiters();
+		});
+	}
+
+	/* Help workers, and sleep until the last task is done. Tasks stolen by
+	 * other threads may wait for their own tasks, so this thread runs them
+	 * while it waits.
+	 */
+	pool.help_until([&] { return remaining == 0; });
+	if (error)
+		rethrow_exception(error);
+}
+
+/* scheme: parallel-map */
+Object Primitive::parallel_map(const vector<Object>& obs)
+{
+	vector<Object> results;
+	parallel_apply(obs, &results, "parallel-map");
+	return make_list(results);
+}
+
+/* scheme: parallel-for-each */
+Object Primitive::parallel_for_each(const vector<Object>& obs)
+{
+	parallel_apply(obs, nullptr, "parallel-for-each");
+	return Object();
+}
+/* scheme: spawn */
+Object Primitive::spawn(const vector<Object>& obs)
+{
+	if (obs.size() != 1 || obs[0].get_type() != PROCEDURE)
+		error_handler("ERROR(scheme): requires a procedure without "
+			"arguments, usage: (spawn (lambda () ...)) -- spawn");
+	return Object(SchemeThread::spawn(obs[0]));
+}
+
+/* scheme: thread-join */
+Object Primitive::thread_join(const vector<Object>& obs)
+{
+	if (obs.size() != 1 || obs[0].get_type() != THREAD)
+		error_handler("ERROR(scheme): requires a thread, usage: "
+			"(thread-join thread) -- thread-join");
+	return obs[0].get_thread()->join();
+}
+
+/* Return the channel of obs[0] */
+static Channel& get_channel(const vector<Object>& obs, size_t n,
+	const string& proc_name)
+{
+	if (obs.size() != n || obs[0].get_type() != CHANNEL)
+		error_handler("ERROR(scheme): requires a channel and " +
+			to_string(n - 1) + " more arguments -- " + proc_name);
+	return *obs[0].get_channel();
+}
+
+/* scheme: make-channel */
+Object Primitive::make_channel(const vector<Object>& obs)
+{
+	int capacity = 1;
+	if (obs.size() > 1 ||
+		(obs.size() == 1 && obs[0].get_type() != INTEGER))
+		error_handler("ERROR(scheme): usage: (make-channel [capacity]) "
+			"-- make-channel");
+	if (obs.size() == 1)
+		capacity = obs[0].get_integer();
+	if (capacity < 1)
+		error_handler("ERROR(scheme): capacity must be positive "
+			"-- make-channel");
+	return Object(make_shared<Channel>(capacity));
+}
+
+/* scheme: channel-put */
+Object Primitive::channel_put(const vector<Object>& obs)
+{
+	get_channel(obs, 2, "channel-put").put(obs[1]);
+	return Object();
+}
+
+/* scheme: channel-get */
+Object Primitive::channel_get(const vector<Object>& obs)
+{
+	return get_channel(obs, 1, "channel-get").get();
+}
+
+/* scheme: channel-close */
+Object Primitive::channel_close(const vector<Object>& obs)
+{
+	get_channel(obs, 1, "channel-close").close();
+	return Object();
+}
+
+/* Continuation captured by call/cc, it's valid until call/cc returns */
+struct Continuation {
+	bool		valid;
+	thread::id	owner;	/* Thread of call/cc */
+};
+
+/* Thrown by calling a continuation, caught by its call/cc */
+struct ContinuationEscape {
+	const Continuation*	target;
+	Object				value;
+};
+
+/* scheme: call/cc, call-with-current-continuation */
+/* Continuations are escape-only: calling k unwinds the C++ frames of the
+ * evaluator back to call/cc, so k can't be called after call/cc returns.
+ */
+Object Primitive::call_cc(const vector<Object>& obs)
+{
+	if (obs.size() != 1 || obs[0].get_type() != PROCEDURE)
+		error_handler("ERROR(scheme): requires a procedure of one argument, "
+			"usage: (call/cc (lambda (k) ...)) -- call/cc");
+
+	auto cont = make_shared<Continuation>();
+	cont->valid = true;
+	cont->owner = this_thread::get_id();
+	Object k(Procedure([cont](const vector<Object>& args) -> Object {
+		if (cont->owner != this_thread::get_id() || !cont->valid)
+			error_handler("ERROR(scheme): the continuation can only be "
+				"used to escape from call/cc -- continuation");
+		if (args.size() > 1)
+			error_handler("ERROR(scheme): a continuation takes at most "
+				"one argument -- continuation");
+		throw ContinuationEscape{ cont.get(), 
+			args.empty() ? Object() : args[0] };
+	}, "continuation"));
+
+	/* Environments of procedures which are unwound */
+	Interpreter& interp = current_interpreter();
+	size_t depth = interp.envs.size();
+	try {
+		Object result = apply_proc(obs[0], vector<Object>{ k });
+		cont->valid = false;
+		return result;
+	}
+	catch (const ContinuationEscape& escape) {
+		remove_frames(interp, depth);
+		if (escape.target != cont.get())
+			throw;	/* Continuation of an outer call/cc */
+		cont->valid = false;
+		return escape.value;
+	}
+	catch (...) {
+		cont->valid = false;
+		throw;
+	}
+}
+
+/* scheme: dynamic-wind */
+Object Primitive::dynamic_wind(const vector<Object>& obs)
+{
+	if (obs.size() != 3 || obs[0].get_type() != PROCEDURE ||
+		obs[1].get_type() != PROCEDURE || obs[2].get_type() != PROCEDURE)
+		error_handler("ERROR(scheme): requires three procedures, usage: "
+			"(dynamic-wind before thunk after) -- dynamic-wind");
+
+	vector<Object> no_args;
+	apply_proc(obs[0], no_args);
+	Object result;
+	try {
+		result = apply_proc(obs[1], no_args);
+	}
+	catch (...) {
+		/* after is called when thunk escapes by a continuation or an error */
+		apply_proc(obs[2], no_args);
+		throw;
+	}
+	apply_proc(obs[2], no_args);
+	return result;
+}
+
+/* scheme: profile-start */
+Object Primitive::profile_start(const vector<Object>& obs)
+{
+	int interval = 1;
+	if (obs.size() > 1 ||
+		(obs.size() == 1 && obs[0].get_type() != INTEGER))
+		error_handler("ERROR(scheme): usage: (profile-start [interval]) "
+			"-- profile-start");
+	if (obs.size() == 1)
+		interval = obs[0].get_integer();
+	if (interval < 1)
+		error_handler("ERROR(scheme): interval must be positive "
+			"-- profile-start");
+	current_interpreter().profiler = make_shared<Profiler>(interval);
+	return Object();
+}
+
+/* Return the profiler of current interpreter */
+static Profiler& get_profiler(const string& proc_name)
+{
+	Interpreter& interp = current_interpreter();
+	if (!interp.profiler)
+		error_handler("ERROR(scheme): the profiler hasn't been started, "
+			"usage: (profile-start) -- " + proc_name);
+	return *interp.profiler;
+}
+
+/* scheme: profile-stop */
+Object Primitive::profile_stop(const vector<Object>&)
+{
+	get_profiler("profile-stop").stop_timer();
+	return Object();
+}
+
+/* scheme: profile-report */
+Object Primitive::profile_report(const vector<Object>& obs)
+{
+	Profiler& profiler = get_profiler("profile-report");
+	OutputPort& port = get_output_port(obs, 0, "profile-report");
+	lock_guard<mutex> guard(port.get_lock());
+	profiler.report(port);
+	return Object();
+}
+
+/* scheme: profile-folded */
+Object Primitive::profile_folded(const vector<Object>& obs)
+{
+	Profiler& profiler = get_profiler("profile-folded");
+	OutputPort& port = get_output_port(obs, 0, "profile-folded");
+	lock_guard<mutex> guard(port.get_lock());
+	profiler.report_folded(port);
+	return Object();
+}
+
+/* scheme: runtime-stats-start */
+Object Primitive::runtime_stats_start(const vector<Object>& obs)
+{
+	if (!obs.empty())
+		error_handler("ERROR(scheme): no arguments required, usage: "
+			"(runtime-stats-start) -- runtime-stats-start");
+	update_cons_count();	/* Pairs allocated before are not counted */
+	current_interpreter().stats = make_shared<RuntimeStats>();
+	return Object();
+}
+
+/* Return the statistics of current interpreter */
+static RuntimeStats& get_stats(const string& proc_name)
+{
+	Interpreter& interp = current_interpreter();
+	if (!interp.stats)
+		error_handler("ERROR(scheme): statistics haven't been started, "
+			"usage: (runtime-stats-start) -- " + proc_name);
+	return *interp.stats;
+}
+
+/* scheme: runtime-stats */
+Object Primitive::runtime_stats(const vector<Object>&)
+{
+	RuntimeStats& stats = get_stats("runtime-stats");
+	update_cons_count();
+	return stats.to_list();
+}
+
+/* scheme: runtime-stats-json */
+Object Primitive::runtime_stats_json(const vector<Object>& obs)
+{
+	RuntimeStats& stats = get_stats("runtime-stats-json");
+	update_cons_count();
+	OutputPort& port = get_output_port(obs, 0, "runtime-stats-json");
+	lock_guard<mutex> guard(port.get_lock());
+	stats.write_json(port);
+	return Object();
+}
+
+/* scheme: trace-start */
+Object Primitive::trace_start(const vector<Object>& obs)
+{
+	if (obs.size() > 1 || 
+		(obs.size() == 1 && (obs[0].get_type() != INTEGER || 
+		obs[0].get_integer() < 1)))
+		error_handler("ERROR(scheme): requires a positive integer, usage: "
+			"(trace-start [capacity]) -- trace-start");
+	::trace_start(obs.empty() ? TRACE_CAPACITY : obs[0].get_integer());
+	return Object();
+}
+
+/* scheme: trace-stop */
+Object Primitive::trace_stop(const vector<Object>& obs)
+{
+	if (!obs.empty())
+		error_handler("ERROR(scheme): no arguments required, usage: "
+			"(trace-stop) -- trace-stop");
+	::trace_stop();
+	return Object();
+}
+
+/* scheme: trace-dump */
+Object Primitive::trace_dump(const vector<Object>& obs)
+{
+	OutputPort& port = get_output_port(obs, 0, "trace-dump");
+	lock_guard<mutex> guard(port.get_lock());
+	::trace_dump(port);
+	return Object();
+}
@@ -5,163 +5,372 @@
 
 #include <fstream>
 #include <cmath>
+#include <climits>
+#include <cctype>
 #include "object.h"
 
-#define NDEBUG
-
 namespace Primitive {
 	/* Quit */
 	/* Note: obs should/could be empty */
-	Object quit(vector<Object>& obs);
+	Object quit(const vector<Object>& obs);
 
 	/* Reset Evaluator, initialize environment */
 	/* Note: obs should/could be empty */
-	Object reset(vector<Object>& obs);
+	Object reset(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a number */
-	Object is_number(vector<Object>& obs);
+	Object is_number(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a boolean */
-	Object is_boolean(vector<Object>& obs);
+	Object is_boolean(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a integer */
-	Object is_integer(vector<Object>& obs);
+	Object is_integer(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a real */
-	Object is_real(vector<Object>& obs);
+	Object is_real(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a even integer */
-	Object is_even(vector<Object>& obs);
+	Object is_even(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a odd integer */
-	Object is_odd(vector<Object>& obs);
+	Object is_odd(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a pair(or list) */
-	Object is_pair(vector<Object>& obs);
+	Object is_pair(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a empty list */
-	Object is_null(vector<Object>& obs);
+	Object is_null(const vector<Object>& obs);
 
 	/* Return #t(true) if object is a list */
-	Object is_list(vector<Object>& obs);
+	Object is_list(const vector<Object>& obs);
 
 
 /* Primitive operation, note: result's type could be INTEGER or REAL */
 	/* Return the sum of obs */
-	Object add(vector<Object>& obs);
+	Object add(const vector<Object>& obs);
 
 	/* Return the difference of obs */
-	Object sub(vector<Object>& obs);
+	Object sub(const vector<Object>& obs);
 
 	/* Return the product of obs */
-	Object mul(vector<Object>& obs);
+	Object mul(const vector<Object>& obs);
 
 	/* Return the quotient of obs */
 	/* Note: always return real(double), which is different from scheme */
-	Object div(vector<Object>& obs);
+	Object div(const vector<Object>& obs);
 
 	/* Return remainder, it takes two arguments */
-	Object remainder(vector<Object>& obs);
+	Object remainder(const vector<Object>& obs);
 
 	/* Return quotient */
-	Object quotient(vector<Object>& obs);
+	Object quotient(const vector<Object>& obs);
 
 	/* Return absolute value */
-	Object abs(vector<Object>& obs);
+	Object abs(const vector<Object>& obs);
 
 	/* Return the square of object */
-	Object square(vector<Object>& obs);
+	Object square(const vector<Object>& obs);
 
 	/* Return the sqrt of object */
-	Object sqrt(vector<Object>& obs);
+	Object sqrt(const vector<Object>& obs);
 
 
 /* Return true or false as an Object, all obs must be number */
 	/* Return true if obs[0] < obs[1] < obs[2] < ... < obs[n] */
-	Object less(vector<Object>& obs);
+	Object less(const vector<Object>& obs);
 
 	/* Return true if obs[0] > obs[1] > obs[2] > ... > obs[n] */
-	Object greater(vector<Object>& obs);
+	Object greater(const vector<Object>& obs);
 
 	/* Return true if obs[0] == obs[1] == obs[2] == ... == obs[n] */
 	/* arguments must be numbers */
-	Object op_equal(vector<Object>& obs);
+	Object op_equal(const vector<Object>& obs);
 
 	/* Return true if obs[0] <= obs[1] <= obs[2] <= ... <= obs[n] */
-	Object lessEqual(vector<Object>& obs);
+	Object lessEqual(const vector<Object>& obs);
 
 	/* Return true if obs[0] >= obs[1] >= obs[2] >= ... >= obs[n] */
-	Object greaterEqual(vector<Object>& obs);
+	Object greaterEqual(const vector<Object>& obs);
 
 
 	/* Return the minimum object of obs */
-	Object min(vector<Object>& obs);
+	Object min(const vector<Object>& obs);
 
 	/* Return the maximum object of obs */
-	Object max(vector<Object>& obs);
+	Object max(const vector<Object>& obs);
 
 
 	/* Return true if obs[0] equal obs[1] equal obs[2] equal .. equal obs[n]*/
 	/* arguments could be all types */
-	Object equal(vector<Object>& obs);
+	Object equal(const vector<Object>& obs);
 
 	/* Operator! */
-	Object not(vector<Object>& obs);
-
-	/* Operator| */
-	Object or (vector<Object>& obs);
-
-	/* Operator& */
-	Object and (vector<Object>& obs);
+	Object op_not(const vector<Object>& obs);
 
 
 	/* Print obs */
-	Object display(vector<Object>& obs);
+	Object display(const vector<Object>& obs);
+
+	/* Print obs, strings are printed with quotations */
+	Object write(const vector<Object>& obs);
 
 	/* New line */
-	Object newline(vector<Object>& obs);
+	Object newline(const vector<Object>& obs);
+
+	/* Write the buffered output of display, write and newline */
+	Object flush_output_port(const vector<Object>& obs);
+
+	/* Print the characters of a string */
+	Object write_string(const vector<Object>& obs);
+
+	/* Print a character */
+	Object write_char(const vector<Object>& obs);
+
+
+/* Ports, the output procedures above take a port as the last argument */
+	/* Open a file for input */
+	Object open_input_file(const vector<Object>& obs);
+
+	/* Open a file for output */
+	Object open_output_file(const vector<Object>& obs);
+
+	/* Return an input port which reads characters from a string */
+	Object open_input_string(const vector<Object>& obs);
+
+	/* Return an output port which accumulates characters */
+	Object open_output_string(const vector<Object>& obs);
+
+	/* Return the characters accumulated in a port of open-output-string */
+	Object get_output_string(const vector<Object>& obs);
+
+	/* Close a port */
+	Object close_port(const vector<Object>& obs);
+
+	/* Read a line from a port(standard input by default) */
+	Object read_line(const vector<Object>& obs);
+
+	/* Read a character from a port(standard input by default) */
+	Object read_char(const vector<Object>& obs);
+
+	/* Return the next character of a port without moving */
+	Object peek_char(const vector<Object>& obs);
+
+	/* Read a datum from a port(standard input by default) */
+	Object read(const vector<Object>& obs);
+
+	/* Return an eof object */
+	Object eof_object(const vector<Object>& obs);
+
+	/* Return #t(true) if object is an eof object */
+	Object is_eof_object(const vector<Object>& obs);
+
+	/* Return #t(true) if object is an input port */
+	Object is_input_port(const vector<Object>& obs);
+
+	/* Return #t(true) if object is an output port */
+	Object is_output_port(const vector<Object>& obs);
+
+	/* Return the port of standard input */
+	Object current_input_port(const vector<Object>& obs);
+
+	/* Return the port of standard output */
+	Object current_output_port(const vector<Object>& obs);
+
+	/* Call a procedure with the port of a output file, then close it */
+	Object call_with_output_file(const vector<Object>& obs);
+
+	/* Call a procedure with the port of a input file, then close it */
+	Object call_with_input_file(const vector<Object>& obs);
 
 	/* Load code from input file and evaluate */
 	/* Usage: (load "path/name.scm") */
-	Object load(vector<Object>& obs);
+	Object load(const vector<Object>& obs);
 
 
 	/* Return the pair of obs as an Object */
 	/* Note: obs.size() must be 2 */
-	Object make_cons(vector<Object>& obs);
+	Object make_cons(const vector<Object>& obs);
 
 	/* Return the list of obs as an Object */
-	Object make_list(vector<Object>& obs);
+	Object make_list(const vector<Object>& obs);
 
 	/* Return the car of object */
-	Object car(vector<Object>& obs);
+	Object car(const vector<Object>& obs);
 
 	/* Return the cdr of object */
-	Object cdr(vector<Object>& obs);
+	Object cdr(const vector<Object>& obs);
 
 	/* Return the caar of object */
-	Object caar(vector<Object>& obs);
+	Object caar(const vector<Object>& obs);
 
 	/* Return the cadr of object */
-	Object cadr(vector<Object>& obs);
+	Object cadr(const vector<Object>& obs);
 
 	/* Return the cdar of object */
-	Object cdar(vector<Object>& obs);
+	Object cdar(const vector<Object>& obs);
 
 	/* Return the cddr of object */
-	Object cddr(vector<Object>& obs);
+	Object cddr(const vector<Object>& obs);
 
 	/* Append an object or a list to obs[0] */
-	Object append(vector<Object>& obs);
+	Object append(const vector<Object>& obs);
 
 	/* Return length of obs[0] */
-	Object length(vector<Object>& obs);
+	Object length(const vector<Object>& obs);
+
+	/* Return the k-th element of a list, (list-ref '(a b c) 1) --> b */
+	Object list_ref(const vector<Object>& obs);
+
+	/* Return the first tail of a list whose car is obs[0], #f if none.
+	 * Elements are compared by equal?, or by the procedure obs[2]:
+	 * (member x list [compare]). A list which isn't proper is an error.
+	 */
+	Object member(const vector<Object>& obs);
+
+	/* Return the first pair of an association list whose car is obs[0],
+	 * #f if none, (assoc 'b '((a 1) (b 2))) --> (b 2). assoc compares keys
+	 * by equal?, or by the procedure obs[2]; assq compares them by identity,
+	 * so two strings of the same characters are different keys.
+	 * A list which isn't proper is an error.
+	 */
+	Object assoc(const vector<Object>& obs);
+	Object assq(const vector<Object>& obs);
+
+	/* Return a new list of the elements of a list sorted by less?, the sort
+	 * is stable: (sort list less?) (list-sort less? list)
+	 */
+	Object sort(const vector<Object>& obs);
+	Object list_sort(const vector<Object>& obs);
+
+
+/* Strings, strings are immutable, so they share their characters */
+	/* Return #t(true) if object is a string */
+	Object is_string(const vector<Object>& obs);
+
+	/* Return the number of characters of a string */
+	Object string_length(const vector<Object>& obs);
+
+	/* Return the k-th character of a string, (string-ref "abc" 1) --> #\b */
+	Object string_ref(const vector<Object>& obs);
+
+	/* Return characters start..end-1 of a string, end is the length of the
+	 * string default, (substring "hello" 1 3) --> "el"
+	 */
+	Object substring(const vector<Object>& obs);
+
+	/* Return a string of the characters of all obs, built in one allocation */
+	Object string_append(const vector<Object>& obs);
+
+	/* Compare strings, return true if obs[0] = obs[1] = ... or
+	 * obs[0] < obs[1] < ... in lexicographic order
+	 */
+	Object string_equal(const vector<Object>& obs);
+	Object string_less(const vector<Object>& obs);
+
+	/* Return the number of a string, #f if it isn't a number */
+	Object string_to_number(const vector<Object>& obs);
+
+	/* Return the string of a number, such as (number->string 1.5) --> "1.5" */
+	Object number_to_string(const vector<Object>& obs);
+
+	/* Return the list of fields of a string split by a character or a
+	 * string, (string-split "a,b,,c" #\,) --> ("a" "b" "" "c"); without
+	 * a separator, fields are separated by whitespace and empty fields are
+	 * skipped.
+	 */
+	Object string_split(const vector<Object>& obs);
+
+	/* Return the index of the first character of a string from start which
+	 * is obs[1] or satisfies predicate obs[1], #f if there is none.
+	 * Usage: (string-index "a b" #\space) (string-index s char-pred [start])
+	 */
+	Object string_index(const vector<Object>& obs);
 
 	/* scheme: map */
-	Object map(vector<Object>& obs);
+	Object map(const vector<Object>& obs);
 
 	/* scheme: for-each */
-	Object for_each(vector<Object>& obs);
+	Object for_each(const vector<Object>& obs);
+
+	/* scheme: apply, the last argument is the list of the rest arguments */
+	/* Usage: (apply + 1 2 '(3 4)) */
+	Object apply(const vector<Object>& obs);
+
+	/* scheme: map, procedure is applied on the workers of thread pool */
+	/* Note: procedure shouldn't change variables outside of it */
+	Object parallel_map(const vector<Object>& obs);
+
+	/* scheme: for-each, procedure is applied on the workers of thread pool */
+	Object parallel_for_each(const vector<Object>& obs);
+
+	/* (spawn thunk): call thunk in a new thread, return the thread */
+	Object spawn(const vector<Object>& obs);
+
+	/* (thread-join thread): wait for thread, return the value of its thunk */
+	Object thread_join(const vector<Object>& obs);
+
+	/* (make-channel [capacity]): return a channel, capacity is 1 default */
+	Object make_channel(const vector<Object>& obs);
+
+	/* (channel-put channel ob): wait while channel is full */
+	Object channel_put(const vector<Object>& obs);
+
+	/* (channel-get channel): wait while channel is empty, return the eof
+	 * object if channel is closed and empty.
+	 */
+	Object channel_get(const vector<Object>& obs);
+
+	/* (channel-close channel) */
+	Object channel_close(const vector<Object>& obs);
+
+	/* (call/cc proc): call proc with the continuation of call/cc,
+	 * continuations are escape-only.
+	 */
+	Object call_cc(const vector<Object>& obs);
+
+	/* (dynamic-wind before thunk after) */
+	Object dynamic_wind(const vector<Object>& obs);
+
+	/* (profile-start [interval]): start sampling procedure calls every
+	 * interval milliseconds, 1 default.
+	 */
+	Object profile_start(const vector<Object>& obs);
+
+	/* (profile-stop): stop sampling, samples are kept for reports */
+	Object profile_stop(const vector<Object>& obs);
+
+	/* (profile-report [port]): print self and total time of procedures */
+	Object profile_report(const vector<Object>& obs);
+
+	/* (profile-folded [port]): print samples as folded stacks, which is
+	 * the input of flamegraph.pl.
+	 */
+	Object profile_folded(const vector<Object>& obs);
+
+	/* (runtime-stats-start): start/restart collecting statistics */
+	Object runtime_stats_start(const vector<Object>& obs);
+
+	/* (runtime-stats): return statistics as a list, such as
+	 * ((calls . 10) (frames . 4) (cons . 2) (max-depth . 3)
+	 *  (procedures (fib 9 0.1) (+ 1 0.001))), time is in milliseconds.
+	 */
+	Object runtime_stats(const vector<Object>& obs);
+
+	/* (runtime-stats-json [port]): print statistics as JSON */
+	Object runtime_stats_json(const vector<Object>& obs);
+
+	/* (trace-start [capacity]): start tracing calls, returns, errors and
+	 * allocations, keep the last capacity events of each thread, 16384
+	 * default.
+	 */
+	Object trace_start(const vector<Object>& obs);
+
+	/* (trace-stop): stop tracing, events are kept for trace-dump */
+	Object trace_stop(const vector<Object>& obs);
+
+	/* (trace-dump [port]): print events as Chrome trace-event JSON */
+	Object trace_dump(const vector<Object>& obs);
 };
 
 #endif
\ No newline at end of file
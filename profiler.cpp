@@ -0,0 +1,107 @@
+/* Implement of the sampling profiler */
+
+#include <algorithm>
+#include <cstdio>
+#include <chrono>
+#include "profiler.h"
+#include "port.h"
+
+Profiler::Profiler(int ms) : interval(ms), tick(false), sample_cnt(0),
+	stop(false)
+{
+	timer = thread(&Profiler::timer_loop, this);
+}
+
+void Profiler::stop_timer()
+{
+	if (!timer.joinable())
+		return;
+	{
+		lock_guard<mutex> guard(timer_lock);
+		stop = true;
+	}
+	wake_up.notify_all();
+	timer.join();
+}
+
+void Profiler::timer_loop()
+{
+	unique_lock<mutex> guard(timer_lock);
+	while (!wake_up.wait_for(guard, chrono::milliseconds(interval),
+		[this] { return stop; }))
+		tick.store(true, memory_order_relaxed);
+}
+
+void Profiler::sample(const CallStack& stack)
+{
+	string folded("main");
+	for (auto name : stack) {
+		folded.push_back(';');
+		folded += *name;
+	}
+	lock_guard<mutex> guard(lock);
+	stacks[folded]++;
+	sample_cnt++;
+}
+
+void Profiler::report(OutputPort& port)
+{
+	struct Count { string name; size_t self, total; };
+	vector<Count> counts;
+	size_t total_samples;
+	{
+		lock_guard<mutex> guard(lock);
+		total_samples = sample_cnt;
+		unordered_map<string, size_t> index;	/* Name --> counts[i] */
+		for (auto &stack : stacks) {
+			/* Split "main;f;g", a recursive procedure is counted once in
+			 * total of a sample.
+			 */
+			vector<string> names;
+			size_t begin = 0, end;
+			do {
+				end = stack.first.find(';', begin);
+				names.push_back(stack.first.substr(begin, end - begin));
+				begin = end + 1;
+			} while (end != string::npos);
+			for (size_t i = 1; i < names.size(); i++) {
+				auto found = index.find(names[i]);
+				if (found == index.end()) {
+					found = index.emplace(names[i], counts.size()).first;
+					counts.push_back(Count{ names[i], 0, 0 });
+				}
+				Count& count = counts[found->second];
+				if (i == names.size() - 1)
+					count.self += stack.second;
+				if (find(names.begin() + i + 1, names.end(), names[i]) ==
+					names.end())
+					count.total += stack.second;
+			}
+		}
+	}
+	sort(counts.begin(), counts.end(), [](const Count& a, const Count& b) {
+		return a.self != b.self ? a.self > b.self : a.total > b.total;
+	});
+
+	char line[256];
+	port.put(line, snprintf(line, sizeof(line),
+		"Samples: %zu, interval: %d ms\n", total_samples, interval));
+	port.put("  self%  total%    self   total  procedure\n");
+	double percent = total_samples == 0 ? 0 : 100.0 / total_samples;
+	for (auto &count : counts) {
+		port.put(line, snprintf(line, sizeof(line), "%6.1f%% %6.1f%% %7zu %7zu  ",
+			count.self * percent, count.total * percent, count.self,
+			count.total));
+		port.put(count.name);
+		port.put('\n');
+	}
+}
+
+void Profiler::report_folded(OutputPort& port)
+{
+	lock_guard<mutex> guard(lock);
+	for (auto &stack : stacks) {
+		port.put(stack.first);
+		port.put(' ' + to_string(stack.second) + '\n');
+	}
+}
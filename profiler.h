@@ -0,0 +1,69 @@
+/* Header file of the sampling profiler */
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+class OutputPort;
+
+/* Call stack of Scheme, names of the procedures being called */
+using CallStack = vector<const string*>;
+
+/* Sampling profiler:
+ * a timer thread requests a sample every interval, the evaluator takes the
+ * sample at the next procedure call or return, see CallFrame in eval.cpp,
+ * so the call stack is only read by its own thread.
+ */
+class Profiler {
+public:
+	/* Start the timer, interval is in milliseconds */
+	explicit Profiler(int interval);
+	Profiler(const Profiler&) = delete;
+	Profiler& operator=(const Profiler&) = delete;
+	/* Stop the timer */
+	~Profiler() { stop_timer(); }
+
+	/* Stop the timer, samples are kept for reports */
+	void stop_timer();
+
+	/* Take a sample of stack if the timer requested one */
+	void poll(const CallStack& stack) {
+		if (tick.load(memory_order_relaxed) && tick.exchange(false))
+			sample(stack);
+	}
+
+	/* Print self and total samples of each procedure, sorted by self */
+	void report(OutputPort& port);
+	/* Print samples as folded stacks, such as "main;fib;+ 12", which is 
+	 * the input of flamegraph.pl.
+	 */
+	void report_folded(OutputPort& port);
+
+private:
+	/* Loop of the timer thread */
+	void timer_loop();
+	/* Add stack to samples */
+	void sample(const CallStack& stack);
+
+	int					interval;	/* Milliseconds between samples */
+	atomic<bool>		tick;		/* A sample is requested */
+
+	mutex				lock;		/* Samples may come from several threads */
+	unordered_map<string, size_t>	stacks;	/* Folded stack --> samples */
+	size_t				sample_cnt;
+
+	bool				stop;
+	mutex				timer_lock;
+	condition_variable	wake_up;
+	thread				timer;
+};
+
+#endif
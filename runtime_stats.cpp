@@ -0,0 +1,108 @@
+/* Implement of runtime statistics */
+
+#include <algorithm>
+#include <cstdio>
+#include "runtime_stats.h"
+#include "port.h"
+
+RuntimeStats::Clock::time_point RuntimeStats::enter(const string& name)
+{
+	{
+		lock_guard<mutex> guard(lock);
+		ProcStats& proc = procs[name];
+		proc.calls++;
+		proc.active++;
+		total_calls++;
+	}
+	return Clock::now();
+}
+
+void RuntimeStats::leave(const string& name, Clock::time_point start)
+{
+	Clock::time_point end = Clock::now();
+	lock_guard<mutex> guard(lock);
+	ProcStats& proc = procs[name];
+	if (--proc.active == 0)
+		proc.time += end - start;
+}
+
+void RuntimeStats::frame(size_t depth)
+{
+	lock_guard<mutex> guard(lock);
+	frames++;
+	max_depth = std::max(max_depth, depth);
+}
+
+vector<pair<string, RuntimeStats::ProcStats>> RuntimeStats::sorted_procs()
+{
+	vector<pair<string, ProcStats>> result;
+	{
+		lock_guard<mutex> guard(lock);
+		result.assign(procs.begin(), procs.end());
+	}
+	sort(result.begin(), result.end(), [](const pair<string, ProcStats>& a,
+		const pair<string, ProcStats>& b) {
+		return a.second.time != b.second.time ? 
+			a.second.time > b.second.time : a.second.calls > b.second.calls;
+	});
+	return result;
+}
+
+/* Return milliseconds of time */
+static double to_ms(RuntimeStats::Clock::duration time)
+{
+	return chrono::duration<double, milli>(time).count();
+}
+
+/* Return (name . value) */
+static Object make_entry(const string& name, const Object& value)
+{
+	return Object(Cons(Object(name, SYMBOL), value));
+}
+
+Object RuntimeStats::to_list()
+{
+	Object proc_list("nil", NIL);
+	vector<pair<string, ProcStats>> sorted = sorted_procs();
+	for (auto it = sorted.rbegin(); it != sorted.rend(); ++it) {
+		Object item(Cons(Object(it->first, SYMBOL), 
+			Object(Cons(Object(static_cast<int>(it->second.calls)),
+			Object(Cons(Object(to_ms(it->second.time)), 
+			Object("nil", NIL)))))));
+		proc_list = Object(Cons(item, proc_list));
+	}
+
+	lock_guard<mutex> guard(lock);
+	vector<Object> entries{
+		make_entry("calls", Object(static_cast<int>(total_calls))),
+		make_entry("frames", Object(static_cast<int>(frames))),
+		make_entry("cons", Object(static_cast<int>(cons))),
+		make_entry("max-depth", Object(static_cast<int>(max_depth))),
+		Object(Cons(Object("procedures", SYMBOL), proc_list))
+	};
+	Object result("nil", NIL);
+	for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+		result = Object(Cons(*it, result));
+	return result;
+}
+
+void RuntimeStats::write_json(OutputPort& port)
+{
+	vector<pair<string, ProcStats>> sorted = sorted_procs();
+	char number[128];
+	{
+		lock_guard<mutex> guard(lock);
+		port.put(number, snprintf(number, sizeof(number), 
+			"{\"calls\": %zu, \"frames\": %zu, \"cons\": %zu, "
+			"\"max_depth\": %zu, \"procedures\": [", 
+			total_calls, frames, cons, max_depth));
+	}
+	for (size_t i = 0; i < sorted.size(); i++) {
+		port.put(i == 0 ? "\n  {\"name\": " : ",\n  {\"name\": ");
+		put_json_string(port, sorted[i].first);
+		port.put(number, snprintf(number, sizeof(number), 
+			", \"calls\": %zu, \"time_ms\": %.3f}", 
+			sorted[i].second.calls, to_ms(sorted[i].second.time)));
+	}
+	port.put("\n]}\n");
+}
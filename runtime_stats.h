@@ -0,0 +1,72 @@
+/* Header file of runtime statistics */
+
+#ifndef RUNTIME_STATS_H_
+#define RUNTIME_STATS_H_
+
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+using namespace std;
+
+#include "object.h"
+
+class OutputPort;
+
+/* Runtime statistics, started by (runtime-stats-start):
+ * calls and time of each procedure, environment frames, pairs allocated
+ * and max depth of environments. Statistics are updated by apply_proc,
+ * the interpreters of workers share the statistics of their parent.
+ */
+class RuntimeStats {
+public:
+	using Clock = chrono::steady_clock;
+
+	RuntimeStats() : total_calls(0), frames(0), max_depth(0), cons(0) {}
+	RuntimeStats(const RuntimeStats&) = delete;
+	RuntimeStats& operator=(const RuntimeStats&) = delete;
+
+	/* A procedure named name is called, return the time of calling */
+	Clock::time_point enter(const string& name);
+	/* The procedure returns, time of recursive calls is counted once */
+	void leave(const string& name, Clock::time_point start);
+	/* A environment frame is created, depth is the number of frames */
+	void frame(size_t depth);
+	/* n pairs are allocated, see update_cons_count() in eval.cpp */
+	void add_cons(size_t n) {
+		lock_guard<mutex> guard(lock);
+		cons += n;
+	}
+
+	/* Return statistics as a list:
+	 * ((calls . n) (frames . n) (cons . n) (max-depth . n)
+	 *  (procedures (name calls milliseconds) ...))
+	 */
+	Object to_list();
+	/* Print statistics as JSON */
+	void write_json(OutputPort& port);
+
+	/* Totals, used by the benchmark harness */
+	size_t get_calls() { lock_guard<mutex> guard(lock); return total_calls; }
+	size_t get_frames() { lock_guard<mutex> guard(lock); return frames; }
+	size_t get_cons() { lock_guard<mutex> guard(lock); return cons; }
+
+private:
+	struct ProcStats {
+		size_t				calls = 0;
+		size_t				active = 0;		/* Calls haven't returned */
+		Clock::duration		time = Clock::duration::zero();
+	};
+
+	/* Procedures sorted by time */
+	vector<pair<string, ProcStats>> sorted_procs();
+
+	mutex							lock;
+	unordered_map<string, ProcStats>	procs;
+	size_t							total_calls;
+	size_t							frames;
+	size_t							max_depth;
+	size_t							cons;
+};
+
+#endif
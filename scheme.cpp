@@ -0,0 +1,61 @@
+/* Implement of the embedding interface */
+
+#include "scheme.h"
+
+/* Return a list of obs */
+Object to_object(const vector<Object>& obs)
+{
+	Object result("nil", NIL);
+	for (auto it = obs.rbegin(); it != obs.rend(); ++it)
+		result = Object(Cons(*it, result));
+	return result;
+}
+
+/* Raise an error for a object which can't be converted to type */
+[[noreturn]] static void conversion_error(const Object& ob, const string& type)
+{
+	error_handler("ERROR(scheme): can't convert " + ob.get_type_str() +
+		" to " + type + " -- from_object");
+}
+
+template <> int from_object<int>(const Object& ob)
+{
+	if (ob.get_type() == INTEGER)
+		return ob.get_integer();
+	if (ob.get_type() == REAL &&
+		ob.get_real() == static_cast<int>(ob.get_real()))
+		return static_cast<int>(ob.get_real());
+	conversion_error(ob, "int");
+}
+
+template <> double from_object<double>(const Object& ob)
+{
+	if (ob.get_type() == REAL)
+		return ob.get_real();
+	if (ob.get_type() == INTEGER)
+		return ob.get_integer();
+	conversion_error(ob, "double");
+}
+
+template <> bool from_object<bool>(const Object& ob)
+{
+	return is_true(ob);
+}
+
+template <> string from_object<string>(const Object& ob)
+{
+	if (ob.get_type() == STRING || ob.get_type() == SYMBOL)
+		return ob.get_string();
+	conversion_error(ob, "string");
+}
+
+template <> vector<Object> from_object<vector<Object>>(const Object& ob)
+{
+	vector<Object> result;
+	Object rest = ob;
+	for (; rest.get_type() == CONS; rest = rest.get_cons()->cdr())
+		result.push_back(rest.get_cons()->car());
+	if (rest.get_type() != NIL)
+		conversion_error(ob, "vector");
+	return result;
+}
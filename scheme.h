@@ -0,0 +1,51 @@
+/* Header file of the embedding interface:
+ * a C++ program hosts interpreters with it, for example:
+ *
+ *	Interpreter interp;
+ *	interp.define_procedure("host-count", [&](const vector<Object>& obs) {
+ *		return to_object(++count);
+ *	});
+ *	interp.eval_string("(define (rule x) (* x (host-count)))");
+ *	int n = from_object<int>(interp.call("rule", { to_object(3) }));
+ *
+ * Errors of Scheme are thrown as SchemeError, the interpreter can be used
+ * again after an error.
+ */
+
+#ifndef SCHEME_H_
+#define SCHEME_H_
+
+#include <cstring>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include "object.h"
+#include "io_function.h"
+#include "eval.h"
+
+/* Convert C++ values to Objects */
+inline Object to_object(int val) { return Object(val); }
+inline Object to_object(double val) { return Object(val); }
+inline Object to_object(bool val) { return Object(val); }
+inline Object to_object(const string& s) { return Object(s); }
+inline Object to_object(const char* s) { return Object(s); }
+/* Return a list of obs */
+Object to_object(const vector<Object>& obs);
+
+/* Convert Objects to C++ values, raise an error if the type of ob is
+ * different, such as from_object<int>(a string).
+ */
+template <typename T> T from_object(const Object& ob);
+/* A real with integral value is converted to int, such as 2.0 --> 2 */
+template <> int from_object<int>(const Object& ob);
+/* An integer is converted to double */
+template <> double from_object<double>(const Object& ob);
+/* Every object except #f is true, same as "if" */
+template <> bool from_object<bool>(const Object& ob);
+/* A string or a symbol */
+template <> string from_object<string>(const Object& ob);
+/* Elements of a list */
+template <> vector<Object> from_object<vector<Object>>(const Object& ob);
+
+#endif
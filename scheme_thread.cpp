@@ -0,0 +1,90 @@
+/* Implement of threads and channels of Scheme */
+
+#include "scheme_thread.h"
+
+SchemeThread::SchemeThread(const Object& t) :
+	interp(current_interpreter()), thunk(t)
+{
+	interp.load_depth = 0;
+	/* Procedures of the spawning thread may return before the thread */
+	interp.call_stack.clear();
+	/* Counted before the thread starts, frames are shared from now on */
+	running_threads++;
+}
+
+shared_ptr<SchemeThread> SchemeThread::spawn(const Object& thunk)
+{
+	shared_ptr<SchemeThread> self(new SchemeThread(thunk));
+	/* The thread keeps self alive until it finishes */
+	self->worker = thread([self] { self->run(); });
+	return self;
+}
+
+SchemeThread::~SchemeThread()
+{
+	/* The last owner may be the thread itself */
+	if (worker.joinable())
+		worker.detach();
+}
+
+void SchemeThread::run()
+{
+	InterpreterScope scope(interp);
+	try {
+		result = apply_proc(thunk, vector<Object>());
+	}
+	catch (...) {
+		error = current_exception();
+	}
+	/* The thunk may be kept by the frame which keeps the thread */
+	thunk = Object();
+	running_threads--;
+	/* Output of the thread is written before join returns */
+	lock_guard<mutex> guard(interp.output_port->get_lock());
+	interp.output_port->flush();
+}
+
+Object SchemeThread::join()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		if (worker.joinable())
+			worker.join();
+	}
+	if (error)
+		rethrow_exception(error);
+	return result;
+}
+
+void Channel::put(const Object& ob)
+{
+	unique_lock<mutex> guard(lock);
+	not_full.wait(guard, [this] { return closed || items.size() < capacity; });
+	if (closed)
+		error_handler("ERROR(scheme): the channel has been closed "
+			"-- channel-put");
+	items.push_back(ob);
+	not_empty.notify_one();
+}
+
+Object Channel::get()
+{
+	unique_lock<mutex> guard(lock);
+	not_empty.wait(guard, [this] { return closed || !items.empty(); });
+	if (items.empty())
+		return Object("eof", EOF_OBJECT);
+	Object ob = items.front();
+	items.pop_front();
+	not_full.notify_one();
+	return ob;
+}
+
+void Channel::close()
+{
+	{
+		lock_guard<mutex> guard(lock);
+		closed = true;
+	}
+	not_full.notify_all();
+	not_empty.notify_all();
+}
@@ -0,0 +1,78 @@
+/* Header file of threads and channels of Scheme */
+
+#ifndef SCHEME_THREAD_H_
+#define SCHEME_THREAD_H_
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+using namespace std;
+
+#include "object.h"
+#include "eval.h"
+
+/* Thread of Scheme, created by "(spawn thunk)":
+ * the thunk is called in a new thread, which evaluates in a copy of the
+ * interpreter of the spawning thread. Procedures and the frames where they
+ * were created are shared by threads, see Frame.
+ */
+class SchemeThread {
+public:
+	/* Start a thread to call thunk */
+	static shared_ptr<SchemeThread> spawn(const Object& thunk);
+
+	SchemeThread(const SchemeThread&) = delete;
+	SchemeThread& operator=(const SchemeThread&) = delete;
+	/* A thread which hasn't been joined keeps running */
+	~SchemeThread();
+
+	/* Wait for the thread, return the value of thunk, or throw the error
+	 * of thunk. A thread can be joined more than once.
+	 */
+	Object join();
+
+private:
+	explicit SchemeThread(const Object& thunk);
+
+	/* Called in the new thread */
+	void run();
+
+	Interpreter		interp;		/* Copy of the spawning interpreter */
+	Object			thunk;
+	Object			result;
+	exception_ptr	error;
+	thread			worker;
+	mutex			lock;		/* Used by join */
+};
+
+/* Bounded channel, used to pass objects between threads:
+ * put waits while the channel is full, get waits while the channel is empty.
+ */
+class Channel {
+public:
+	explicit Channel(size_t cap) : capacity(cap), closed(false) {}
+	Channel(const Channel&) = delete;
+	Channel& operator=(const Channel&) = delete;
+
+	/* Add ob to the end of channel, raise an error if it's closed */
+	void put(const Object& ob);
+	/* Remove an object from the front of channel, return the eof object
+	 * if the channel is closed and empty.
+	 */
+	Object get();
+	/* Close channel, waiting threads are woken up */
+	void close();
+
+private:
+	mutex				lock;
+	condition_variable	not_full;
+	condition_variable	not_empty;
+	deque<Object>		items;
+	size_t				capacity;
+	bool				closed;
+};
+
+#endif
@@ -4,12 +4,15 @@
 #include <string>
 #include <sstream>
 #include <vector>
+#include <thread>
 using namespace std;
 
 #include "eval.h"
 #include "io_function.h"
 #include "object.h"
 #include "primitive_procedures.h"
+#include "port.h"
+#include "scheme.h"
 
 static int test_cnts = 0, test_pass = 0;
 
@@ -44,22 +47,63 @@ static void test_io()
  */
 #define REPORT_ERROR(actual, expect) \
 	do {\
-		cerr << "<TEST ERROR> line: " << __LINE__ /*<< __FILE__ */ \
-			<< ", expect: { " << expect.get_type_str() << ", ";\
-		Primitive::display(vector<Object>{expect});\
-		cerr << "}, actual: { " << actual.get_type_str() << ", ";\
-		Primitive::display(vector<Object>{actual});\
-		cerr << "}" << endl;\
+		OutputPort err(cerr);\
+		err.put("<TEST ERROR> line: " + to_string(__LINE__) /*+ __FILE__ */ \
+			+ ", expect: { " + expect.get_type_str() + ", ");\
+		err.print(expect, true);\
+		err.put("}, actual: { " + actual.get_type_str() + ", ");\
+		err.print(actual, true);\
+		err.put("}\n");\
 	} while(0)
 
 #define TEST(code, expect_result)\
+	do {\
+		test_cnts++;\
+		string copy(code);\
+		istringstream iss(copy + "\n");\
+		try {\
+			Object result = eval(split_input(get_input(iss)));\
+			if (expect_result == result) test_pass++;\
+			else REPORT_ERROR(result, expect_result);\
+		}\
+		catch (const SchemeError& e) {\
+			cerr << "<TEST ERROR> line: " << __LINE__ << ", " << e.what() << endl;\
+			remove_frames(current_interpreter(), 1);\
+		}\
+	} while(0)
+
+/* Evaluating code must fail with a SchemeError */
+#define TEST_ERROR(code)\
+	do {\
+		test_cnts++;\
+		string copy(code);\
+		istringstream iss(copy + "\n");\
+		try {\
+			eval(split_input(get_input(iss)));\
+			cerr << "<TEST ERROR> line: " << __LINE__ << ", expect an error" << endl;\
+		}\
+		catch (const SchemeError&) {\
+			test_pass++;\
+			/* Remove frames of procedures which haven't returned */\
+			remove_frames(current_interpreter(), 1);\
+		}\
+	} while(0)
+
+/* Print the value of code to a string, and compare it with expect_str */
+#define TEST_PRINT(code, write_mode, expect_str)\
 	do {\
 		test_cnts++;\
 		string copy(code);\
 		istringstream iss(copy + "\n");\
 		Object result = eval(split_input(get_input(iss)));\
-		if (expect_result == result) test_pass++;\
-		else REPORT_ERROR(result, expect_result);\
+		ostringstream oss;\
+		{\
+			OutputPort port(oss);\
+			port.print(result, write_mode);\
+		}\
+		if (oss.str() == expect_str) test_pass++;\
+		else cerr << "<TEST ERROR> line: " << __LINE__ << ", expect: "\
+			<< expect_str << ", actual: " << oss.str() << endl;\
 	} while(0)
 
 /* Test primitive procedures 1 */
@@ -221,14 +265,25 @@ static void test_primitive_3()
 	TEST("(not 1)", Object(false));
 	TEST("(not 0)", Object(false));
 
-	TEST("(or 1 2 3)", Object(true));
+	TEST("(or 1 2 3)", Object(1));
 	TEST("(or #f #f #f #t #f)", Object(true));
 	TEST("(or #f #f)", Object(false));
 	TEST("(or #t #t)", Object(true));
 
-	TEST("(and #t #t 1)", Object(true));
+	TEST("(and #t #t 1)", Object(1));
 	TEST("(and #t #t #f #t)", Object(false));
 	TEST("(and #f #f 1)", Object(false));
+	/* Operands after the deciding one are not evaluated */
+	TEST("(and)", Object(true));
+	TEST("(or)", Object(false));
+	TEST("(and 1 #f (car '()))", Object(false));
+	TEST("(or #f 2 (car '()))", Object(2));
+	load_code("(define evaluated 0)");
+	load_code("(or (set! evaluated 1) (set! evaluated 2))");
+	TEST("evaluated", Object(1));
+	TEST("(when #f (car '()))", Object());
+	TEST("(unless #t (car '()))", Object());
+	TEST("(unless #f 1 2)", Object(2));
 }
 
 /* Test cons(pair) and list */
@@ -242,7 +297,7 @@ static void test_cons_list()
 	TEST("(car (cdr b))", Object(4));
 	TEST("(length b)", Object(3));
 	
-	load_code("define c (cons (cons 1 2) (cons 3 4))");
+	load_code("(define c (cons (cons 1 2) (cons 3 4)))");
 	TEST("(caar c)", Object(1));
 	TEST("(cdar c)", Object(2));
 	TEST("(cadr c)", Object(3));
@@ -261,29 +316,583 @@ static void test_cons_list()
 	load_code("(define map_lst (map (lambda (x) (* x x)) lst))"); 
 	TEST("(car map_lst)", Object(4));
 	TEST("(cadr map_lst)", Object(9));
+	TEST("(car lst)", Object(2));
+
+	/* Test list-ref, member, assoc and assq */
+	TEST("(list-ref '(a b c) 2)", Object("c", SYMBOL));
+	TEST_ERROR("(list-ref '(a b c) 3)");
+	TEST("(car (member 3 '(1 3 5)))", Object(3));
+	TEST("(length (member 3 '(1 3 5)))", Object(2));
+	TEST("(member 4 '(1 3 5))", Object(false));
+	TEST("(car (member 3.0 '(1 3 5) =))", Object(3));
+	TEST("(cadr (assoc \"b\" '((\"a\" 1) (\"b\" 2))))", Object(2));
+	TEST("(cadr (assq 'c '((a 1) (c 3))))", Object(3));
+	TEST("(assq 'd '((a 1) (c 3)))", Object(false));
+	TEST_ERROR("(assq 'a '(1 2))");
+	/* assq compares by identity, assoc by equal? */
+	load_code("(define key \"k\")");
+	load_code("(define key-list (list 1))");
+	TEST("(assq \"k\" (list (list \"k\" 1)))", Object(false));
+	TEST("(cadr (assq key (list (list key 1))))", Object(1));
+	TEST("(assq (list 1) (list (list key-list 2)))", Object(false));
+	TEST("(cadr (assq key-list (list (list key-list 2))))", Object(2));
+	TEST("(cadr (assoc \"k\" (list (list \"k\" 1))))", Object(1));
+	/* Lists must be proper */
+	TEST_ERROR("(member 4 '(1 3 . 5))");
+	TEST_ERROR("(member 4 5)");
+	TEST_ERROR("(assoc 'b 'a)");
+	TEST_ERROR("(assq 'b '((a 1) . 2))");
+
+	/* Test sort, the sort is stable */
+	load_code("(define sorted (sort (list 5 1.5 -2 3) <))");
+	TEST("(car sorted)", Object(-2));
+	TEST("(list-ref sorted 3)", Object(5));
+	TEST("(car (list-sort > '(5 1.5 -2 3)))", Object(5));
+	TEST("(car (sort '(\"b\" \"c\" \"a\") string<?))", Object("a"));
+	load_code("(define pairs (sort '((1 . a) (0 . b) (1 . c) (0 . d))"
+		" (lambda (x y) (< (car x) (car y)))))");
+	TEST("(cdar pairs)", Object("b", SYMBOL));
+	TEST("(cdr (list-ref pairs 2))", Object("a", SYMBOL));
+	TEST("(sort '() <)", Object("nil", NIL));
+	TEST_ERROR("(sort '(1 2) 3)");
+}
+
+/* Test quote and quasiquote expression */
+static void test_quote()
+{
+	TEST("'a", Object("a", SYMBOL));
+	TEST("(quote a)", Object("a", SYMBOL));
+	TEST("(car '(a b))", Object("a", SYMBOL));
+	TEST("(cadr '(a \"b\" 3))", Object("b"));
+	TEST("(car (cadr '(1 (2 3))))", Object(2));
+	TEST("(cdr '(1 . 2))", Object(2));
+	TEST("(car ''a)", Object("quote", SYMBOL));
+	TEST("(null? '())", Object(true));
+
+	/* The datum of quote is constructed only once */
+	load_code("(define (const-list) '(1 2 3))");
+	TEST("(eq? (const-list) (const-list))", Object(true));
+
+	load_code("(define x 3)");
+	TEST("(cadr `(1 ,x))", Object(3));
+	TEST("(car `(,(+ x 1) 5))", Object(4));
+	TEST("(length `(1 ,@(list 2 3) 4))", Object(4));
+	TEST("(cadr `(1 ,@'() 4))", Object(4));
+	TEST("(car (cadr `(1 `(2 ,(3 ,x)))))", Object("quasiquote", SYMBOL));
+
+	/* Unquoted expressions are evaluated from left to right */
+	load_code("(define order '())");
+	load_code("(define (note! n) (set! order (cons n order)) n)");
+	load_code("(define result `(,(note! 1) ,@(list (note! 2)) ,(note! 3)))");
+	TEST("(car order)", Object(3));
+	TEST("(cadr order)", Object(2));
+	TEST("(car (cddr result))", Object(3));
+}
+
+/* Test display and write */
+static void test_print()
+{
+	TEST_PRINT("(list 1 2 3)", false, "(1 2 3)");
+	TEST_PRINT("(cons 1 2)", false, "(1 . 2)");
+	TEST_PRINT("'(1 (2 3) . 4)", false, "(1 (2 3) . 4)");
+	TEST_PRINT("'()", false, "()");
+	TEST_PRINT("(list 1.5 #t #f 'a)", false, "(1.5 #t #f a)");
+	TEST_PRINT("\"a b\"", false, "a b");
+	TEST_PRINT("\"a b\"", true, "\"a b\"");
+	TEST_PRINT("(list \"a\" \"b\")", true, "(\"a\" \"b\")");
+	TEST_PRINT("car", false, "<primitive procedure: car>");
+
+	/* Numbers are read and printed in the shortest form of the same value */
+	TEST_PRINT("0.1", false, "0.1");
+	TEST_PRINT("(/ 1.0 3)", false, "0.3333333333333333");
+	TEST_PRINT("123456789.25", false, "123456789.25");
+	TEST_PRINT("3000000000.0", false, "3e+09");
+	TEST_PRINT("(list +5 -.5 1e3)", false, "(5 -0.5 1000.0)");
+	TEST_PRINT("(/ 4.0 2)", false, "2.0");
+	TEST_PRINT("'1+", false, "1+");
+}
+
+/* Test strings */
+static void test_string()
+{
+	TEST("(string? \"abc\")", Object(true));
+	TEST("(string? 'abc)", Object(false));
+	TEST("(string-length \"hello\")", Object(5));
+	TEST("(string-length \"a\\\"b\\n\")", Object(4));
+	TEST("(string-length \"\")", Object(0));
+	TEST("(string-ref \"abc\" 2)", Object("c", CHAR));
+	TEST_ERROR("(string-ref \"abc\" 3)");
+	TEST("(substring \"hello\" 1 3)", Object("el"));
+	TEST("(substring \"hello\" 2)", Object("llo"));
+	TEST_ERROR("(substring \"hello\" 3 1)");
+	TEST("(string-append \"a\" \"bc\" \"\" \"d\")", Object("abcd"));
+	TEST("(string-append)", Object(""));
+	TEST_ERROR("(string-append \"a\" 1)");
+	TEST("(string=? \"ab\" \"ab\" \"ab\")", Object(true));
+	TEST("(string<? \"ab\" \"b\")", Object(true));
+
+	TEST("(string->number \"-42\")", Object(-42));
+	TEST("(string->number \"1.5\")", Object(1.5));
+	TEST("(string->number \"12abc\")", Object(false));
+	TEST("(number->string 42)", Object("42"));
+	TEST("(number->string 2.5)", Object("2.5"));
+	TEST("(string->number \"+7\")", Object(7));
+	/* Integers are exact, up to the range of int */
+	TEST("(string->number \"2147483647\")", Object(INT_MAX));
+	TEST("(string->number \"-2147483648\")", Object(INT_MIN));
+	TEST_ERROR("(string->number \"2147483648\")");
+	TEST_ERROR("(string->number \"-2147483649\")");
+	TEST_ERROR("(string->number \"9223372036854775807\")");
+	TEST_ERROR("(string->number \"-9223372036854775808\")");
+	TEST_ERROR("12345678901234567890");
+	TEST("(string->number \"3000000000.0\")", Object(3000000000.0));
+	TEST("(string->number \"1e-3\")", Object(0.001));
+	TEST("(string->number \"+-5\")", Object(false));
+	TEST("(string->number \"nan\")", Object(false));
+	TEST("(string->number (number->string (/ 2.0 7)))", Object(2.0 / 7));
+	TEST("(number->string 2.0)", Object("2.0"));
+	TEST("(real? (string->number (number->string -3.0)))", Object(true));
+
+	TEST("(length (string-split \"a,b,,c\" #\\,))", Object(4));
+	TEST("(car (cddr (string-split \"a,b,,c\" #\\,)))", Object(""));
+	TEST("(cadr (string-split \"a::b\" \"::\"))", Object("b"));
+	TEST("(length (string-split \"  one two\\tthree \"))", Object(3));
+	TEST("(string-index \"a b\" #\\space)", Object(1));
+	TEST("(string-index \"abc\" #\\z)", Object(false));
+	TEST("(string-index \"abcb\" #\\b 2)", Object(3));
+	TEST("(string-index \"ab1\" (lambda (c) (eq? c #\\1)))", Object(2));
+
+	/* Parentheses and semicolons in strings are characters */
+	TEST("(string-length \"f(x)\")", Object(4));
+	TEST("(string-length \"a;b\")", Object(3));
+	TEST("(cadr (string-split \"a;b\" \";\"))", Object("b"));
+	TEST_PRINT("\"a(b)c\"", true, "\"a(b)c\"");
+	TEST_PRINT("(string-append \"(\" \")\") ; comment", false, "()");
+
+	/* Escape sequences are converted when strings are read */
+	TEST_PRINT("\"a\\\"b\\\\c\"", false, "a\"b\\c");
+	TEST_PRINT("\"a\\\"b\\nc\"", true, "\"a\\\"b\\nc\"");
+}
+
+/* Test string ports and file ports */
+static void test_port()
+{
+	load_code("(define in (open-input-string \"line 1\nline 2\"))");
+	TEST("(read-line in)", Object("line 1"));
+	TEST("(read-char in)", Object("l", CHAR));
+	TEST("(peek-char in)", Object("i", CHAR));
+	TEST("(read-line in)", Object("ine 2"));
+	TEST("(eof-object? (read-line in))", Object(true));
+
+	load_code("(define in (open-input-string \"(1 (2 3)) abc \\\"de\\\"\"))");
+	TEST("(car (cadr (read in)))", Object(2));
+	TEST("(read in)", Object("abc", SYMBOL));
+	TEST("(read in)", Object("de"));
+	TEST("(eof-object? (read in))", Object(true));
+
+	load_code("(define out (open-output-string))");
+	load_code("(write 'a out)");
+	load_code("(display \" b\" out)");
+	load_code("(write-char #\\c out)");
+	load_code("(write \"d\" out)");
+	TEST("(get-output-string out)", Object("a bc\"d\""));
+	TEST("(output-port? out)", Object(true));
+	TEST("(input-port? out)", Object(false));
+
+	/* Write to a file, and read it back */
+	load_code("(call-with-output-file \"test_output.txt\"\
+		(lambda (port) (write '(1 \"two\" #\\3) port) (newline port)))");
+	TEST("(cadr (call-with-input-file \"test_output.txt\" read))",
+		Object("two"));
+	load_code("(define in (open-input-file \"test_output.txt\"))");
+	TEST("(read-line in)", Object("(1 \"two\" #\\3)"));
+	TEST("(eof-object? (read-char in))", Object(true));
+	load_code("(close-port in)");
+}
+
+/* Test map_lines of "--map-lines" */
+static void test_map_lines()
+{
+	Interpreter interp;
+	ostringstream oss;
+	interp.output_port = make_shared<OutputPort>(oss);
+	Object proc = interp.eval_string("(lambda (l) (cond "
+		"((string=? l \"skip\") #f) "
+		"((string=? l \"len\") (string-length l)) "
+		"((string=? l \"none\") (if #f #f)) "
+		"(else (string-append \"<\" l \">\"))))");
+
+	/* "\r\n" is removed, the last line has no '\n' */
+	istringstream in("a\r\nskip\nlen\n\nnone\nb c\nlast");
+	map_lines(interp, in, proc);
+	test_cnts++;
+	oss.str() == "<a>\n3\n<>\n<b c>\n<last>\n" ? test_pass++ : 1;
+
+	/* A line across two chunks of input */
+	oss.str("");
+	string long_line((1 << 20) + 10, 'x');
+	istringstream long_in("x\n" + long_line + "\n");
+	map_lines(interp, long_in, proc);
+	test_cnts++;
+	oss.str() == "<x>\n<" + long_line + ">\n" ? test_pass++ : 1;
+
+	/* The file must return a procedure */
+	test_cnts++;
+	try {
+		istringstream empty("");
+		map_lines(interp, empty, Object(1));
+	}
+	catch (const SchemeError&) {
+		test_pass++;
+	}
+}
+
+/* Test parallel-map and parallel-for-each */
+static void test_parallel()
+{
+	load_code("(define (pfib n) (if (< n 2) n (+ (pfib (- n 1)) (pfib (- n 2)))))");
+	load_code("(define fibs (parallel-map pfib '(10 15 1 2 20)))");
+	TEST("(car fibs)", Object(55));
+	TEST("(cadr fibs)", Object(610));
+	TEST("(length fibs)", Object(5));
+	TEST("(null? (parallel-map pfib '()))", Object(true));
+
+	/* Closures and nested parallel-map */
+	load_code("(define (make-adder k) (lambda (x) (+ x k)))");
+	TEST("(car (parallel-map (make-adder 10) '(1 2 3)))", Object(11));
+	TEST("(caar (parallel-map (lambda (x) (parallel-map pfib (list x x)))\
+		'(5 6 7)))", Object(5));
+
+	/* Errors of workers are reported to the caller */
+	TEST_ERROR("(parallel-map car '(1 2 3))");
+	TEST_ERROR("(parallel-for-each (lambda (x) (car x)) '(1 2))");
+}
+
+/* Test spawn and channels */
+static void test_thread()
+{
+	/* Producer and consumer */
+	load_code("(define ch (make-channel 2))");
+	load_code("(define (produce i n) (if (< i n) "
+		"(begin (channel-put ch i) (produce (+ i 1) n)) (channel-close ch)))");
+	load_code("(define (consume acc) (define x (channel-get ch)) "
+		"(if (eof-object? x) acc (consume (+ acc x))))");
+	load_code("(define producer (spawn (lambda () (produce 0 100))))");
+	TEST("(consume 0)", Object(4950));
+	TEST("(thread-join producer)", Object());
+	TEST("(eof-object? (channel-get ch))", Object(true));
+	TEST_ERROR("(channel-put ch 1)");
+
+	/* Values and errors of threads are returned by thread-join */
+	load_code("(define t (spawn (lambda () (* 6 7))))");
+	TEST("(thread-join t)", Object(42));
+	TEST("(thread-join t)", Object(42));
+	TEST_ERROR("(thread-join (spawn (lambda () (car 1))))");
+	TEST_ERROR("(make-channel 0)");
+	TEST_ERROR("(spawn 1)");
+
+	/* Threads share closures */
+	load_code("(define counter (let ((n 0)) (lambda () (set! n (+ n 1)) n)))");
+	load_code("(define done (make-channel 4))");
+	load_code("(define (count-to k) (if (> k 0) (begin (counter) "
+		"(count-to (- k 1))) (channel-put done #t)))");
+	load_code("(define t1 (spawn (lambda () (count-to 50))))");
+	load_code("(define t2 (spawn (lambda () (count-to 50))))");
+	TEST("(begin (thread-join t1) (thread-join t2) (channel-get done) "
+		"(channel-get done))", Object(true));
+	/* Frames of returned procedures and loops are shared with threads */
+	load_code("(define (start-counting) (let ((n 0)) (spawn (lambda () "
+		"(let loop ((i 0)) (if (< i 500) (begin (set! n (+ n 1)) "
+		"(loop (+ i 1))) n))))))");
+	TEST("(thread-join (start-counting))", Object(500));
+	load_code("(define loop-threads (let loop ((i 0) (ts '())) (if (< i 4) "
+		"(loop (+ i 1) (cons (spawn (lambda () (set! i (* i 10)) i)) ts)) ts)))");
+	TEST("(thread-join (car loop-threads))", Object(30));
+}
+
+/* Test call/cc and dynamic-wind */
+static void test_continuation()
+{
+	TEST("(call/cc (lambda (k) (+ 1 (k 42))))", Object(42));
+	TEST("(+ 1 (call/cc (lambda (k) 2)))", Object(3));
+	TEST("(call-with-current-continuation (lambda (k) (k)))", Object());
+
+	/* Early exit from deep recursion */
+	load_code("(define (find-first pred lst) (call/cc (lambda (return) "
+		"(define (walk l) (if (null? l) #f (begin (if (pred (car l)) "
+		"(return (car l)) #f) (walk (cdr l))))) (walk lst))))");
+	TEST("(find-first (lambda (x) (> x 10)) '(1 5 12 30))", Object(12));
+	TEST("(find-first (lambda (x) (> x 99)) '(1 5 12 30))", Object(false));
+	/* Escape to an outer call/cc */
+	TEST("(call/cc (lambda (outer) (+ 1 (call/cc (lambda (inner) "
+		"(outer 5))))))", Object(5));
+
+	/* Continuations can't be used after call/cc returns */
+	load_code("(define saved (call/cc (lambda (k) k)))");
+	TEST_ERROR("(saved 1)");
+	TEST_ERROR("(call/cc 1)");
+
+	/* after is called when thunk escapes */
+	load_code("(define out (open-output-string))");
+	TEST("(call/cc (lambda (k) (dynamic-wind "
+		"(lambda () (display \"[\" out)) "
+		"(lambda () (display \"body\" out) (k 7) (display \"no\" out)) "
+		"(lambda () (display \"]\" out)))))", Object(7));
+	TEST("(get-output-string out)", Object("[body]"));
+	TEST_ERROR("(dynamic-wind (lambda () 1) (lambda () (car 1)) "
+		"(lambda () (display \"]\" out)))");
+	TEST("(get-output-string out)", Object("[body]]"));
+}
+
+/* Test the profiler */
+static void test_profiler()
+{
+	TEST_ERROR("(profile-report)");
+	load_code("(define (busy n) (if (= n 0) 0 (+ 1 (busy (- n 1)))))");
+	load_code("(define (spin k) (if (> k 0) (begin (busy 50) (spin (- k 1)))))");
+	load_code("(profile-start)");
+	load_code("(spin 20)");
+	load_code("(profile-stop)");
+	load_code("(define out (open-output-string))");
+	load_code("(profile-folded out)");
+	load_code("(profile-report out)");
+	TEST_ERROR("(profile-start 0)");
+	/* Samples are taken only while the profiler is running */
+	ostringstream oss;
+	Interpreter interp;
+	interp.output_port = make_shared<OutputPort>(oss);
+	interp.eval_string("(define (f n) (if (= n 0) 0 (f (- n 1))))");
+	interp.eval_string("(profile-start 1) (f 500) (profile-stop)");
+	interp.eval_string("(profile-folded) (profile-report)");
+	interp.output_port->flush();
+	test_cnts++;
+	oss.str().find("total%") != string::npos ? test_pass++ : 1;
+	test_cnts++;
+	interp.call_stack.size() == 0 ? test_pass++ : 1;
+}
+
+/* Test runtime statistics */
+static void test_runtime_stats()
+{
+	TEST_ERROR("(runtime-stats)");
+	load_code("(runtime-stats-start)");
+	load_code("(define (depth n) (if (= n 0) (list 1 2) (depth (- n 1))))");
+	load_code("(depth 5)");
+	load_code("(define stats (runtime-stats))");
+	/* depth: 6 calls, =: 6 calls, -: 5 calls, list and runtime-stats */
+	TEST("(cdar stats)", Object(19));
+	TEST("(cdr (cadr stats))", Object(6));
+	TEST("(> (cdr (car (cddr stats))) 1)", Object(true));
+	TEST("(> (cdr (cadr (cddr stats))) 5)", Object(true));
+	load_code("(define out (open-output-string))");
+	load_code("(runtime-stats-json out)");
+
+	Interpreter interp;
+	ostringstream oss;
+	interp.output_port = make_shared<OutputPort>(oss);
+	interp.eval_string("(runtime-stats-start) (define (f x) (* x 2)) (f 1)");
+	interp.eval_string("(runtime-stats-json)");
+	interp.output_port->flush();
+	test_cnts++;
+	oss.str().find("{\"calls\": 3, \"frames\": 1, ") == 0 &&
+		oss.str().find("{\"name\": \"f\", \"calls\": 1, ") != string::npos ?
+		test_pass++ : 1;
+}
+
+/* Test the tracer */
+static void test_tracer()
+{
+	TEST_ERROR("(trace-start 0)");
+	Interpreter interp;
+	ostringstream oss;
+	interp.output_port = make_shared<OutputPort>(oss);
+	interp.eval_string("(define (f x) (cons x x)) (trace-start) (f 1)");
+	TEST_ERROR("(car 1)");
+	interp.eval_string("(trace-stop) (f 2) (trace-dump)");
+	interp.output_port->flush();
+	string trace = oss.str();
+	test_cnts++;
+	trace.find("{\"traceEvents\": [") == 0 &&
+		trace.find("{\"name\": \"f\", \"ph\": \"B\"") != string::npos &&
+		trace.find("{\"name\": \"f\", \"ph\": \"E\"") != string::npos &&
+		trace.find("{\"name\": \"cons\", \"ph\": \"C\"") != string::npos ?
+		test_pass++ : 1;
+	test_cnts++;
+	trace.find("\"ph\": \"i\"") != string::npos &&
+		trace.find("incorrect type to car") != string::npos ? test_pass++ : 1;
+
+	/* Only the last 4 events are kept */
+	oss.str("");
+	interp.eval_string("(trace-start 4) (f 1) (f 2) (f 3) (trace-stop)");
+	interp.eval_string("(trace-dump)");
+	interp.output_port->flush();
+	trace = oss.str();
+	size_t events = 0;
+	for (size_t i = trace.find("\"ph\""); i != string::npos; 
+		i = trace.find("\"ph\"", i + 1))
+		events++;
+	test_cnts++;
+	events == 4 && trace.find("\"name\": \"trace-stop\", \"ph\": \"B\"") 
+		!= string::npos ? test_pass++ : 1;
+}
+
+/* Test the embedding interface */
+static void test_embedding()
+{
+	Interpreter interp;
+	int count = 0;
+	interp.define_procedure("host-count", [&](const vector<Object>&) {
+		return to_object(++count);
+	});
+	interp.define("base", to_object(10));
+	interp.eval_string("(define (rule x) (+ base (* x (host-count))))");
+	test_cnts++;
+	interp.call("rule", { to_object(3) }) == Object(13) ? test_pass++ : 1;
+	test_cnts++;
+	from_object<int>(interp.eval_string("(rule 3) (rule 4)")) == 22 ?
+		test_pass++ : 1;
+	test_cnts++;
+	count == 3 ? test_pass++ : 1;
+
+	/* Conversions */
+	test_cnts++;
+	from_object<string>(interp.eval_string("\"a\\\"b\"")) == "a\"b" ?
+		test_pass++ : 1;
+	test_cnts++;
+	from_object<double>(to_object(2)) == 2.0 ? test_pass++ : 1;
+	test_cnts++;
+	from_object<bool>(interp.eval_string("'()")) ? test_pass++ : 1;
+	vector<Object> items = from_object<vector<Object>>(
+		interp.call("list", { to_object("x"), to_object(1.5) }));
+	test_cnts++;
+	items.size() == 2 && from_object<string>(items[0]) == "x" ?
+		test_pass++ : 1;
+	test_cnts++;
+	interp.call("length", { to_object(items) }) == Object(2) ?
+		test_pass++ : 1;
+
+	/* Errors are thrown, the interpreter can be used after errors */
+	test_cnts++;
+	try {
+		interp.eval_string("(define (bad x) (car x)) (bad 1)");
+	}
+	catch (const SchemeError&) {
+		test_pass++;
+	}
+	test_cnts++;
+	try {
+		from_object<int>(to_object("1"));
+	}
+	catch (const SchemeError&) {
+		test_pass++;
+	}
+	interp.eval_string("(define after-error 1)");
+	test_cnts++;
+	interp.lookup("after-error") == Object(1) ? test_pass++ : 1;
+	test_cnts++;
+	interp.envs.size() == 1 ? test_pass++ : 1;
+}
+
+/* Test special forms shadowed by variables */
+static void test_keyword()
+{
+	TEST("(let ((x if)) (x #f 1 2))", Object(2));
+	test_cnts++;
+	!current_interpreter().keywords_shadowed ? test_pass++ : 1;
+
+	Interpreter interp;
+	test_cnts++;
+	interp.eval_string("(define (twice begin x) (begin (begin x))) "
+		"(twice (lambda (y) (* y 2)) 3)") == Object(12) ? test_pass++ : 1;
+	test_cnts++;
+	interp.eval_string("(let ((if (lambda (a b c) c))) (if #t 1 2))") ==
+		Object(2) ? test_pass++ : 1;
+	/* Keywords which aren't bound are still special forms */
+	test_cnts++;
+	interp.eval_string("(if #t 1 2)") == Object(1) ? test_pass++ : 1;
+	interp.eval_string("(define (quote x) 5)");
+	test_cnts++;
+	interp.eval_string("(quote 1)") == Object(5) ? test_pass++ : 1;
+}
+
+/* Test independent interpreters */
+static void test_interpreter()
+{
+	/* Definitions of an interpreter are invisible to the others */
+	Interpreter a, b;
+	load_code(a, "(define x 1)");
+	load_code(b, "(define x 2)");
+	TEST("x", Object(3));
+	test_cnts++;
+	eval(a, Object("x", SYMBOL)) == Object(1) ? test_pass++ : 1;
+	test_cnts++;
+	eval(b, Object("x", SYMBOL)) == Object(2) ? test_pass++ : 1;
+
+	/* Output of an interpreter goes to its own port */
+	ostringstream oss;
+	a.output_port = make_shared<OutputPort>(oss);
+	load_code(a, "(display \"in a\")");
+	a.output_port->flush();
+	test_cnts++;
+	oss.str() == "in a" ? test_pass++ : 1;
+
+	/* Interpreters run in different threads at the same time */
+	vector<Interpreter> interps(4);
+	vector<Object> results(interps.size());
+	vector<thread> threads;
+	for (size_t i = 0; i < interps.size(); i++) {
+		threads.push_back(thread([&, i] {
+			InterpreterScope scope(interps[i]);
+			load_code("(define (count n acc) (if (= n 0) acc "
+				"(count (- n 1) (+ acc 1))))");
+			load_code("(define n " + to_string(i * 100) + ")");
+			istringstream iss("(count n 0)\n");
+			results[i] = eval(split_input(get_input(iss)));
+		}));
+	}
+	for (auto &t : threads)
+		t.join();
+	for (size_t i = 0; i < interps.size(); i++) {
+		test_cnts++;
+		results[i] == Object(static_cast<int>(i * 100)) ? test_pass++ : 1;
+	}
+
+	/* map_lines runs in the given interpreter, as in "--map-lines" where
+	 * no interpreter is current
+	 */
+	Interpreter lines;
+	ostringstream lines_out;
+	lines.output_port = make_shared<OutputPort>(lines_out);
+	Object proc = lines.eval_string("(lambda (l) (string-append l \"!\"))");
+	thread([&] {
+		istringstream in("a\nb\n");
+		map_lines(lines, in, proc);
+	}).join();
+	test_cnts++;
+	lines_out.str() == "a!\nb!\n" ? test_pass++ : 1;
 }
 
 /* Test define expression */
 static void test_define()
 {
-	TEST("(define n 5)", Object("n"));
+	TEST("(define n 5)", Object("n", SYMBOL));
 	TEST("(+ n 6)", Object(11));
 	TEST("(* 4.0 n)", Object(4.0 * 5));
 	/* update n */
-	TEST("(define n 100)", Object("n"));
+	TEST("(define n 100)", Object("n", SYMBOL));
 	TEST("(+ n 6)", Object(106));
 	TEST("(* 4.0 n)", Object(4.0 * 100));
 
-	TEST("(define (square a) (* a a))", Object("square"));
+	TEST("(define (square a) (* a a))", Object("square", SYMBOL));
 	TEST("(square 5)", Object(25));
 	TEST("(square 6.24)", Object(6.24 * 6.24));
 
-	TEST("(define sq (lambda (x) (* x x)))", Object("sq"));
+	TEST("(define sq (lambda (x) (* x x)))", Object("sq", SYMBOL));
 	TEST("(sq 5)", Object(25));
 	TEST("(sq 6.24)", Object(6.24 * 6.24));
 
 	TEST("(define (fact n) (if (< n 2) 1 (* n (fact (- n 1)))))", 
-		Object("fact"));
+		Object("fact", SYMBOL));
 	TEST("(fact 0)", Object(1));
 	TEST("(fact 1)", Object(1));
 	TEST("(fact 2)", Object(2));
@@ -292,12 +901,24 @@ static void test_define()
 	TEST("(fact 10)", Object(3628800));
 
 	TEST("(define (fib n) (if (< n 3) 1 (+ (fib (- n 1)) (fib (- n 2)))))", 
-		Object("fib"));
+		Object("fib", SYMBOL));
 	TEST("(fib 1)", Object(1));
 	TEST("(fib 2)", Object(1));
 	TEST("(fib 3)", Object(2));
 	TEST("(fib 4)", Object(3));
 	TEST("(fib 10)", Object(55));
+
+	/* Internal defines are scoped like letrec*, and closures keep them */
+	load_code("(define (parity) (define (ev? n) (if (= n 0) #t (od? (- n 1))))"
+		" (define (od? n) (if (= n 0) #f (ev? (- n 1)))) ev?)");
+	TEST("((parity) 10)", Object(true));
+	TEST("((parity) 7)", Object(false));
+	TEST("(define (adder a) (lambda (b) (lambda (c) (+ a b c))))",
+		Object("adder", SYMBOL));
+	TEST("(((adder 1) 2) 3)", Object(6));
+	/* Variables of the caller aren't visible in the procedure */
+	TEST("(define (get-local) local)", Object("get-local", SYMBOL));
+	TEST_ERROR("((lambda (local) (get-local)) 1)");
 }
 
 /* Test begin expression */
@@ -316,7 +937,7 @@ static void test_begin()
   (+ a b)\
   (define c 5))"; /* Return the last subexpression as the result */
 	load_code(code);
-	TEST("(f2 2 3)", Object("c")); 
+	TEST("(f2 2 3)", Object("c", SYMBOL)); 
 
 	TEST("\
 (begin (define c1 (cons 1 2))\n\
@@ -336,6 +957,31 @@ static void test_lambda()
 	TEST("((lambda (a b) (* a b)) 3 4)", Object(3 * 4));
 	TEST("((lambda (x y z) (* x y (+ x z))) 3 4 (+ 3 4))", 
 		Object(3 * 4 * (3 + (3 + 4)))); 
+	/* Constants of a body are shared by all calls */
+	load_code("(define (count-up i n) (if (< i n) (count-up (+ i 1) n) i))");
+	TEST("(count-up 0 100)", Object(100));
+	load_code("(define (greeting) \"hi\")");
+	TEST("(begin (greeting) (greeting))", Object("hi"));
+	TEST("(equal? (greeting) (greeting))", Object(true));
+
+	/* Rest parameters */
+	TEST("((lambda args args))", Object("nil", NIL));
+	TEST("(length ((lambda args args) 1 2 3))", Object(3));
+	load_code("(define (tail a . rest) rest)");
+	TEST("(tail 1)", Object("nil", NIL));
+	TEST("(car (tail 1 2 3))", Object(2));
+	TEST_ERROR("(tail)");
+	TEST_ERROR("((lambda (a b) a) 1 2 3 4 5 6 7 8 9 10 11)");
+	/* case-lambda chooses a clause by the number of arguments */
+	load_code("(define area (case-lambda ((r) (* 3 r r)) ((w h) (* w h))"
+		" ((w h . more) (length more))))");
+	TEST("(area 2)", Object(12));
+	TEST("(area 2 5)", Object(10));
+	TEST("(area 2 5 1 1)", Object(2));
+	TEST_ERROR("(area)");
+	TEST("(apply + 1 2 '(3 4))", Object(10));
+	TEST("(cadr (apply tail '(1 2 3)))", Object(3));
+	TEST_ERROR("(apply + 1 2)");
 }
 
 /* Test let expression */
@@ -343,6 +989,21 @@ static void test_let()
 {
 	TEST("(let ((a 3) (b 4)) (+ a b))", Object(3 + 4));
 	TEST("(let ((add +) (mul *)) (mul (add 3 4) (add 2 3)))", Object(7 * 5));
+
+	/* Loops of named let and do don't grow the stack */
+	TEST("(let loop ((i 0)) (if (< i 100000) (loop (+ i 1)) i))", Object(100000));
+	TEST("(do ((i 0 (+ i 1)) (sum 0 (+ sum i))) ((= i 10000) sum))",
+		Object(49995000));
+	TEST("(let loop ((i 0)) (let ((j (* i 2))) (cond ((> j 100) i) "
+		"(else (loop (+ i 1))))))", Object(51));
+	/* The inner loop jumps back to the outer one */
+	TEST("(let outer ((i 0) (n 0)) (if (= i 3) n (let inner ((j 0) (n n)) "
+		"(if (= j 4) (outer (+ i 1) n) (inner (+ j 1) (+ n 1))))))", Object(12));
+	/* Not a tail call, loop is a procedure */
+	TEST("(let fact ((n 5)) (if (= n 0) 1 (* n (fact (- n 1)))))", Object(120));
+	TEST("((car (let loop ((i 0) (fs '())) "
+		"(if (= i 3) fs (loop (+ i 1) (cons (lambda () i) fs))))))", Object(2));
+	TEST_ERROR("(let loop ((i 0)) (if (< i 5) (loop)))");
 }
 
 /* Test cond expression */
@@ -366,6 +1027,82 @@ static void test_cond()
 	TEST(code3, Object());
 }
 
+/* Test define-syntax and derived forms */
+static void test_macro()
+{
+	/* tmp of swap! doesn't capture the caller's tmp */
+	Interpreter interp;
+	test_cnts++;
+	interp.eval_string("(define-syntax swap! (syntax-rules () "
+		"((_ a b) (let ((tmp a)) (set! a b) (set! b tmp))))) "
+		"(define tmp 1) (define y 2) (swap! tmp y) (- tmp y)") == Object(1) ?
+		test_pass++ : 1;
+	load_code("(define-syntax my-list (syntax-rules () "
+		"((_ (a b) ...) (list (+ a b) ...))))");
+	TEST("(length (my-list (1 2) (3 4) (5 6)))", Object(3));
+	TEST("(car (cdr (my-list (1 2) (3 4))))", Object(7));
+	load_code("(define-syntax kw (syntax-rules (to) ((_ a to b) (- b a))))");
+	TEST("(kw 1 to 10)", Object(9));
+	TEST_ERROR("(kw 1 from 10)");
+
+	TEST("(let* ((x 1) (y (+ x 1))) (* x y))", Object(2));
+	TEST("(letrec ((even? (lambda (n) (if (= n 0) #t (odd? (- n 1)))))"
+		"(odd? (lambda (n) (if (= n 0) #f (even? (- n 1)))))) (even? 10))",
+		Object(true));
+	TEST("(let loop ((i 0) (acc 0)) (if (= i 5) acc (loop (+ i 1) (+ acc i))))",
+		Object(10));
+	TEST("(case (* 2 3) ((2 3 5 7) 'prime) ((1 4 6 8 9) 'composite))",
+		Object("composite", SYMBOL));
+	TEST("(case 0 ((1) 'one) (else 'other))", Object("other", SYMBOL));
+	TEST("(cond ((+ 1 1) => (lambda (x) (* x 10))) (else 0))", Object(20));
+	TEST("(cond (#f 1) (3))", Object(3));
+	TEST("(when (> 2 1) 1 2)", Object(2));
+	TEST("(unless (> 2 1) 1)", Object());
+	TEST("(car (do ((i 0 (+ i 1)) (acc '() (cons i acc))) ((= i 3) acc)))",
+		Object(2));
+	TEST("(and (pair? '()) (car '()))", Object(false));
+	TEST("(or #f (car '(1)))", Object(1));
+
+	/* Procedures keep expanded bodies, later macros don't change them */
+	load_code("(define (twice x) (my-list (x x)))");
+	load_code("(define-syntax my-list (syntax-rules () ((_ a) 0)))");
+	TEST("(car (twice 2))", Object(4));
+	/* A local variable hides the macro of the same name */
+	TEST("(let ((when (lambda (x) (* x 3)))) (when 2))", Object(6));
+
+	/* Free identifiers of templates aren't captured by the caller */
+	TEST("(let ((if list)) (cond (#f 1) (else 2)))", Object(2));
+	TEST("(let ((equal? (lambda (a b) #t))) (case 5 ((1) 'one) (else 'other)))",
+		Object("other", SYMBOL));
+	TEST("(let ((let 3) (lambda 4)) (do ((i 0 (+ i 1))) ((= i 3) i)))",
+		Object(3));
+	load_code("(define-syntax bump! (syntax-rules () "
+		"((_) (set! bumps (+ bumps 1)))))");
+	load_code("(define bumps 0)");
+	TEST("((lambda (bumps) (bump!) bumps) 10)", Object(10));
+	TEST("bumps", Object(1));
+	/* A macro defined in a body refers to the local variables there */
+	load_code("(define (add-to x) (define-syntax add-x (syntax-rules () "
+		"((_ y) (+ x y)))) (add-x 1))");
+	TEST("(add-to 10)", Object(11));
+	/* A macro of a body is only visible in the rest of the body */
+	TEST("(let () (define-syntax one (syntax-rules () ((_) 1))) (+ (one) (one)))",
+		Object(2));
+	TEST_ERROR("(one)");
+	TEST("(let () (define-syntax my-or (syntax-rules () ((_) #f) ((_ e) e) "
+		"((_ e r ...) (let ((t e)) (if t t (my-or r ...)))))) "
+		"(define-syntax or3 (syntax-rules () ((_ a) (my-or #f #f a)))) (or3 3))",
+		Object(3));
+	/* A local definition doesn't replace the global macro */
+	TEST("(let () (define kw 5) kw)", Object(5));
+	TEST("(kw 1 to 10)", Object(9));
+	/* The local variable of a template can't be hidden where it's used */
+	TEST("(let ((x 1)) (define-syntax getx (syntax-rules () ((_) x))) "
+		"(let ((y 2)) (getx)))", Object(1));
+	TEST_ERROR("(let ((x 1)) (define-syntax getx (syntax-rules () ((_) x))) "
+		"(let ((x 2)) (getx)))");
+}
+
 /* Test set! expression */
 static void test_set()
 {
@@ -389,25 +1126,39 @@ static void test_set()
 	TEST("(w2 22)", Object(128));
 	TEST("(w1 22)", Object(6));
 	TEST("(w2 22)", Object(106));
-	TEST("(w1 200)", Object("\"Insufficient funds\""));
-	TEST("(w2 200)", Object("\"Insufficient funds\""));
+	TEST("(w1 200)", Object("Insufficient funds"));
+	TEST("(w2 200)", Object("Insufficient funds"));
+
+	/* Closures created in the same frame share its variables */
+	load_code("(define (make-counter) (let ((n 0)) (cons (lambda () (set! n (+ n 1)) n)"
+		" (lambda () n))))");
+	load_code("(define counter (make-counter))");
+	TEST("((car counter))", Object(1));
+	TEST("((car counter))", Object(2));
+	TEST("((cdr counter))", Object(2));
+	TEST("(letrec ((f (lambda () (g))) (g (lambda () 'done))) ((lambda () (f))))",
+		Object("done", SYMBOL));
 }
 
 /* Test load code from file */
 static void test_load_file()
 {
-	load_file("F:/Git/Learning/impl_scheme/test_file/test1.scm");
-	load_file("F:/Git/Learning/impl_scheme/test_file/test2.scm");
+	load_file("test_file/test1.scm");
+	load_file("test_file/test2.scm");
 
 	/* Nested loading, evaluator need to load test3_2.scm in test3_1.scm */
-	load_file("F:/Git/Learning/impl_scheme/test_file/test3_1.scm");
+	load_file("test_file/test3_1.scm");
 
 	/* Nested loading */
-	load_file("F:/Git/Learning/impl_scheme/test_file/test4/test4.scm");
+	load_file("test_file/test4/test4.scm");
 }
 
-void run_test()
+/* Run all tests, return true if all of them pass */
+bool run_test()
 {
+	/* Tests run in their own interpreter */
+	Interpreter interp;
+	InterpreterScope scope(interp);
 #if 1
 	test_io();
 	test_primitive_1();
@@ -415,15 +1166,37 @@ void run_test()
 	test_primitive_2();
 	test_primitive_3();
 	test_cons_list();
+	test_quote();
+	test_print();
+	test_string();
+	test_port();
+	test_map_lines();
+	test_parallel();
+	test_thread();
+	test_continuation();
+	test_profiler();
+	test_runtime_stats();
+	test_tracer();
+	test_interpreter();
+	test_keyword();
+	test_embedding();
 	test_begin();
 	test_lambda();
 	test_let();
 	test_cond();
+	test_macro();
 	test_set();
 #endif
 	test_load_file();
 
+	interp.output_port->flush();
 	cout << "test counts: " << test_cnts << ", test pass: " << test_pass << endl;
 
-	return;
+	return test_pass == test_cnts;
+}
+
+/* Tests load files of test_file, run them in the source directory */
+int main()
+{
+	return run_test() ? 0 : 1;
 }
\ No newline at end of file
@@ -1,6 +1,6 @@
 ;;; SICP exercise 1.46 a
 
-(load "F:/Git/Learning/impl_scheme/test_file/test3_2.scm")
+(load "test_file/test3_2.scm")
 
 (define (average x y)
   (/ (+ x y) 2))
@@ -1,8 +1,8 @@
 ;;; SICP exercise 2.42
 
-(load "F:/Git/Learning/impl_scheme/test_file/test4/p42-adjoin-position.scm")
-(load "F:/Git/Learning/impl_scheme/test_file/test4/p42-safe.scm")
-(load "F:/Git/Learning/impl_scheme/test_file/test4/2-2-3.scm")
+(load "test_file/test4/p42-adjoin-position.scm")
+(load "test_file/test4/p42-safe.scm")
+(load "test_file/test4/2-2-3.scm")
 
 (define (queens board-size)
   (define (queen-cols k)
@@ -0,0 +1,113 @@
+/* Implement of thread pool */
+
+#include "thread_pool.h"
+
+ThreadPool::ThreadPool(int n) : pending(0), next_queue(0), stop(false)
+{
+	if (n < 1)
+		n = 1;
+	for (int i = 0; i < n; i++)
+		queues.push_back(unique_ptr<WorkQueue>(new WorkQueue()));
+	for (int i = 0; i < n; i++)
+		workers.push_back(thread(&ThreadPool::worker_loop, this, i));
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		lock_guard<mutex> guard(sleep_lock);
+		stop = true;
+	}
+	wake_up.notify_all();
+	for (auto &worker : workers)
+		worker.join();
+}
+
+void ThreadPool::submit(Task task)
+{
+	WorkQueue& queue = *queues[next_queue++ % queues.size()];
+	{
+		lock_guard<mutex> guard(queue.lock);
+		queue.tasks.push_back(std::move(task));
+	}
+	{
+		/* Lock to make sure that a worker going to sleep sees the task */
+		lock_guard<mutex> guard(sleep_lock);
+		pending++;
+	}
+	wake_up.notify_one();
+	waiters.notify_all();
+}
+
+bool ThreadPool::pop_task(int index, Task& task)
+{
+	int n = queues.size();
+	for (int i = 0; i < n; i++) {
+		WorkQueue& queue = *queues[(index + i) % n];
+		lock_guard<mutex> guard(queue.lock);
+		if (queue.tasks.empty())
+			continue;
+		/* Own queue: take the front; other queues: steal the back */
+		if (i == 0) {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+		else {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		}
+		pending--;
+		return true;
+	}
+	return false;
+}
+
+bool ThreadPool::run_pending_task()
+{
+	Task task;
+	if (!pop_task(next_queue % queues.size(), task))
+		return false;
+	task();
+	return true;
+}
+
+void ThreadPool::help_until(const function<bool()>& finished)
+{
+	while (!finished()) {
+		if (run_pending_task())
+			continue;
+		unique_lock<mutex> guard(sleep_lock);
+		waiters.wait(guard, [&] { return pending > 0 || finished(); });
+	}
+}
+
+void ThreadPool::notify_waiters()
+{
+	/* Lock to make sure that a waiter checking finished() sees the change */
+	{
+		lock_guard<mutex> guard(sleep_lock);
+	}
+	waiters.notify_all();
+}
+
+void ThreadPool::worker_loop(int index)
+{
+	Task task;
+	while (true) {
+		if (pop_task(index, task)) {
+			task();
+			task = nullptr;
+			continue;
+		}
+		unique_lock<mutex> guard(sleep_lock);
+		wake_up.wait(guard, [this] { return stop || pending > 0; });
+		if (stop && pending == 0)
+			return;
+	}
+}
+
+ThreadPool& ThreadPool::instance()
+{
+	static ThreadPool pool(thread::hardware_concurrency());
+	return pool;
+}
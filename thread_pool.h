@@ -0,0 +1,80 @@
+/* Header file of thread pool */
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace std;
+
+/* Work-stealing thread pool:
+ * every worker has its own queue of tasks, it takes tasks from the front of
+ * its own queue, and steals tasks from the back of the others' queues when
+ * its own queue is empty.
+ */
+class ThreadPool {
+public:
+	using Task = function<void()>;
+
+	/* Constructor, start n workers */
+	explicit ThreadPool(int n);
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/* Destructor, wait for the workers to finish their tasks */
+	~ThreadPool();
+
+	/* Number of workers */
+	int size() const { return workers.size(); }
+
+	/* Add a task to the queue of a worker, queues are used in turn */
+	void submit(Task task);
+
+	/* Run a task in the calling thread, return false if there is no task.
+	 * Used by the thread which is waiting for its tasks, so that a task of
+	 * a worker could wait for other tasks without blocking the worker.
+	 */
+	bool run_pending_task();
+
+	/* Run tasks in the calling thread until finished() returns true, sleep
+	 * while there is no task. The task which makes finished() true must call
+	 * notify_waiters() after that.
+	 */
+	void help_until(const function<bool()>& finished);
+
+	/* Wake up the threads in help_until() to check their conditions */
+	void notify_waiters();
+
+	/* The thread pool shared by the evaluator, it has a worker per core */
+	static ThreadPool& instance();
+
+private:
+	struct WorkQueue {
+		mutex		lock;
+		deque<Task>	tasks;
+	};
+
+	/* Take a task from queues[index], or steal one from other queues */
+	bool pop_task(int index, Task& task);
+
+	/* Loop of workers[index] */
+	void worker_loop(int index);
+
+	vector<unique_ptr<WorkQueue>>	queues;
+	vector<thread>					workers;
+
+	mutex				sleep_lock;		/* Used by idle workers */
+	condition_variable	wake_up;
+	condition_variable	waiters;		/* Threads in help_until() */
+	atomic<int>			pending;		/* Number of tasks in queues */
+	atomic<unsigned>	next_queue;		/* Queue of the next task */
+	bool				stop;
+};
+
+#endif
@@ -0,0 +1,135 @@
+/* Implement of execution tracer */
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "tracer.h"
+#include "port.h"
+
+atomic<bool> trace_enabled(false);
+
+/* An event of 64 bytes */
+struct TraceEvent {
+	long long	time;		/* Nanoseconds of steady clock */
+	size_t		value;
+	TracePhase	phase;
+	char		name[47];
+};
+
+/* Ring buffer of a thread, only the thread writes it */
+struct TraceBuffer {
+	TraceBuffer(size_t capacity, unsigned gen, int id) :
+		events(capacity), generation(gen), tid(id), count(0) {}
+
+	vector<TraceEvent>	events;
+	unsigned			generation;	/* trace_start() drops old buffers */
+	int					tid;
+	atomic<size_t>		count;		/* Number of events recorded */
+};
+
+static mutex trace_lock;		/* Lock of the variables below */
+static vector<shared_ptr<TraceBuffer>> trace_buffers;
+static size_t trace_capacity = TRACE_CAPACITY;
+static atomic<unsigned> trace_generation(0);
+static atomic<long long> trace_origin(0);	/* Time of trace_start() */
+static atomic<int> next_tid(0);
+
+static thread_local shared_ptr<TraceBuffer> local_buffer;
+static thread_local int local_tid = 0;
+
+static long long now_ns()
+{
+	return chrono::duration_cast<chrono::nanoseconds>(
+		chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/* Create the buffer of current thread for the current generation */
+static TraceBuffer* new_buffer()
+{
+	if (local_tid == 0)
+		local_tid = ++next_tid;
+	lock_guard<mutex> guard(trace_lock);
+	local_buffer = make_shared<TraceBuffer>(trace_capacity,
+		trace_generation.load(), local_tid);
+	trace_buffers.push_back(local_buffer);
+	return local_buffer.get();
+}
+
+void trace_start(size_t capacity)
+{
+	{
+		lock_guard<mutex> guard(trace_lock);
+		trace_buffers.clear();
+		trace_capacity = capacity;
+		trace_origin = now_ns();
+		trace_generation++;
+	}
+	trace_enabled = true;
+}
+
+void trace_stop()
+{
+	trace_enabled = false;
+}
+
+void trace_record(TracePhase phase, const char* name, size_t n, size_t value)
+{
+	if (!tracing())
+		return;
+	TraceBuffer* buffer = local_buffer.get();
+	if (buffer == nullptr || buffer->generation != trace_generation.load())
+		buffer = new_buffer();
+
+	size_t i = buffer->count.load(memory_order_relaxed);
+	TraceEvent& event = buffer->events[i % buffer->events.size()];
+	event.time = now_ns();
+	event.value = value;
+	event.phase = phase;
+	if (n >= sizeof(event.name)) {
+		if (phase == TRACE_ERROR)
+			name += n - (sizeof(event.name) - 1);
+		n = sizeof(event.name) - 1;
+	}
+	memcpy(event.name, name, n);
+	event.name[n] = '\0';
+	buffer->count.store(i + 1, memory_order_release);
+}
+
+void trace_dump(OutputPort& port)
+{
+	vector<shared_ptr<TraceBuffer>> buffers;
+	{
+		lock_guard<mutex> guard(trace_lock);
+		buffers = trace_buffers;
+	}
+	long long origin = trace_origin.load();
+	char number[128];
+	bool first = true;
+	port.put("{\"traceEvents\": [");
+	for (auto &buffer : buffers) {
+		size_t count = buffer->count.load(memory_order_acquire);
+		size_t capacity = buffer->events.size();
+		for (size_t i = count > capacity ? count - capacity : 0; i < count; i++) {
+			const TraceEvent& event = buffer->events[i % capacity];
+			port.put(first ? "\n  {\"name\": " : ",\n  {\"name\": ");
+			first = false;
+			put_json_string(port, event.phase == TRACE_ERROR ? "error" : event.name);
+			port.put(number, snprintf(number, sizeof(number),
+				", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d",
+				event.phase, (event.time - origin) / 1000.0, buffer->tid));
+			if (event.phase == TRACE_ERROR) {
+				port.put(", \"s\": \"t\", \"args\": {\"message\": ");
+				put_json_string(port, event.name);
+				port.put('}');
+			}
+			else if (event.phase == TRACE_ALLOC)
+				port.put(number, snprintf(number, sizeof(number),
+					", \"args\": {\"thread %d\": %zu}", buffer->tid, event.value));
+			port.put('}');
+		}
+	}
+	port.put("\n], \"displayTimeUnit\": \"ms\"}\n");
+}
@@ -0,0 +1,61 @@
+/* Header file of execution tracer */
+
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include <atomic>
+#include <string>
+using namespace std;
+
+class OutputPort;
+
+/* Events of tracer, values are the phases of Chrome trace events */
+enum TracePhase : char {
+	TRACE_CALL = 'B',		/* A procedure is called */
+	TRACE_RETURN = 'E',		/* The procedure returns */
+	TRACE_ERROR = 'i',		/* An error is raised */
+	TRACE_ALLOC = 'C'		/* A pair is allocated */
+};
+
+/* Default number of events kept by each thread */
+const size_t TRACE_CAPACITY = 16384;
+
+/* Tracer: every thread records its events into its own ring buffer, so
+ * only the last events of each thread are kept. Recording doesn't lock,
+ * and costs a check of trace_enabled when tracing is off. Events are
+ * written as Chrome trace-event JSON, which can be opened by
+ * chrome://tracing or Perfetto.
+ */
+extern atomic<bool> trace_enabled;
+
+inline bool tracing()
+{
+	return trace_enabled.load(memory_order_relaxed);
+}
+
+/* Start tracing, keep the last capacity events of each thread, events
+ * recorded before are dropped.
+ */
+void trace_start(size_t capacity = TRACE_CAPACITY);
+
+/* Stop tracing, events are kept for trace_dump */
+void trace_stop();
+
+/* Record an event of current thread, long names are truncated, errors keep
+ * the end of the message which names the procedure. value is the number of
+ * pairs allocated by the thread, used by TRACE_ALLOC.
+ */
+void trace_record(TracePhase phase, const char* name, size_t n,
+	size_t value = 0);
+inline void trace_record(TracePhase phase, const string& name)
+{
+	trace_record(phase, name.data(), name.size());
+}
+
+/* Write events as Chrome trace-event JSON, events of a thread are written
+ * in order. Other threads shouldn't record events at the same time, stop
+ * tracing or join them first.
+ */
+void trace_dump(OutputPort& port);
+
+#endif